@@ -0,0 +1,265 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "config.h"
+#include "util.h"
+#include "translate.h"
+#include "exec.h"
+#include "idiom.h"
+#include "memory.h"
+#include "io.h"
+#include "cpu.h"
+#include "emu.h"
+#include "object.h"
+#include "bench.h"
+
+// End to end benchmark. A script drives the machine from power on through a
+// workload, and the same script is run once by every execution engine, each
+// from a fresh machine and an empty block pool. Script lines are:
+//
+//   press <out> <in>          Press the key between OUT and IN bits
+//   release <out> <in>        Release it
+//   key <out> <in> [<hold>]   Press, run hold cycles (default 20000), release
+//   load <file>               Push the object in a binary object file
+//   run <cycles>              Run, stopping early if the CPU goes idle
+//   idle <cycles>             Run until the CPU goes idle
+//   pc <hex> <cycles>         Run until a block starts at address hex
+//   screen <hex> <cycles>     Run until the screen hash is hex
+//
+// The last three are checkpoints. Each engine gives one line of key=value
+// pairs in a fixed order, numbers without units are counts.
+
+#define MAX_COMMANDS    (1024)
+#define CPU_CLOCK       (3686400) // 48G Saturn clock, in Hz
+#define SCREEN_POLL     (4096) // Cycles between screen hash checks
+
+typedef enum {
+    CMD_PRESS, CMD_RELEASE, CMD_KEY, CMD_LOAD, CMD_RUN, CMD_IDLE, CMD_PC, CMD_SCREEN
+} CMD_TYPE;
+
+typedef struct {
+    CMD_TYPE type;
+    int out;
+    int in;
+    uint32_t value;     // Checkpoint address or screen hash
+    uint64_t cycles;
+    uint8_t *obj;       // Object to load
+    int size;
+} COMMAND;
+
+typedef struct {
+    const char *name;
+    bool fusion;
+    bool idiom;
+    bool direct;
+} ENGINE;
+
+static const ENGINE engines[] = {
+    { "plain", false, false, false },
+    { "fused", true, false, false },
+    { "idiom", true, true, false },
+    { "full", true, true, true },
+};
+
+static COMMAND commands[MAX_COMMANDS];
+static int command_count;
+
+static const char *command_names[] = {
+    "press", "release", "key", "load", "run", "idle", "pc", "screen"
+};
+
+static bool parse(const char *fn) {
+    FILE *fp = fopen(fn, "r");
+    if (!fp)
+        return false;
+    char line[512];
+    command_count = 0;
+    for (int n = 1; fgets(line, sizeof(line), fp); n++) {
+        char name[16];
+        char file[256];
+        unsigned long long a, c;
+        int args;
+        if ((line[0] == '#') || (line[0] == '\n') ||
+                (sscanf(line, "%15s", name) != 1))
+            continue;
+        int type = 0;
+        while ((type <= CMD_SCREEN) && strcmp(command_names[type], name))
+            type++;
+        if (type > CMD_SCREEN)
+            fatal("%s:%d: unknown command %s\n", fn, n, name);
+        if (command_count == MAX_COMMANDS)
+            fatal("%s:%d: too many commands\n", fn, n);
+        COMMAND *cmd = &commands[command_count++];
+        cmd->type = type;
+        // Counts are decimal, addresses and hashes hexadecimal
+        switch (type) {
+        case CMD_PRESS:
+        case CMD_RELEASE:
+        case CMD_KEY:
+            args = sscanf(line, "%*s %d %d %llu", &cmd->out, &cmd->in, &c);
+            if (args < 2)
+                fatal("%s:%d: expected <out> <in>\n", fn, n);
+            cmd->cycles = (args == 3) ? c : 20000;
+            break;
+        case CMD_LOAD:
+            if (sscanf(line, "%*s %255s", file) != 1)
+                fatal("%s:%d: expected <file>\n", fn, n);
+            cmd->size = object_load(file, &cmd->obj);
+            if (cmd->size < 0)
+                fatal("%s:%d: unable to load object %s\n", fn, n, file);
+            break;
+        case CMD_RUN:
+        case CMD_IDLE:
+            if (sscanf(line, "%*s %llu", &c) != 1)
+                fatal("%s:%d: expected <cycles>\n", fn, n);
+            cmd->cycles = c;
+            break;
+        default:
+            if (sscanf(line, "%*s %llx %llu", &a, &c) != 2)
+                fatal("%s:%d: expected <hex> <cycles>\n", fn, n);
+            cmd->value = a;
+            cmd->cycles = c;
+            break;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+static bool run_screen(uint32_t hash, uint64_t cycles) {
+    uint64_t end = cpu.cycles + cycles;
+    while (emu_screen_hash() != hash) {
+        if ((cpu.cycles >= end) || (cpu.shutdown && !cpu.int_pending))
+            return false;
+        emu_run((end - cpu.cycles < SCREEN_POLL) ? end - cpu.cycles :
+                SCREEN_POLL);
+    }
+    return true;
+}
+
+// Run the whole script, returns the number of checkpoints reached
+static int run_script() {
+    int reached = 0;
+    for (int i = 0; i < command_count; i++) {
+        const COMMAND *cmd = &commands[i];
+        switch (cmd->type) {
+        case CMD_PRESS:
+            io_key(cmd->out, cmd->in, true);
+            break;
+        case CMD_RELEASE:
+            io_key(cmd->out, cmd->in, false);
+            break;
+        case CMD_KEY:
+            io_key(cmd->out, cmd->in, true);
+            emu_run(cmd->cycles);
+            io_key(cmd->out, cmd->in, false);
+            break;
+        case CMD_LOAD: {
+            uint32_t address;
+            if (!object_push(cmd->obj, cmd->size, &address))
+                fprintf(stderr, "Warning: unable to push object %d\n", i);
+            break;
+        }
+        case CMD_RUN:
+            emu_run(cmd->cycles);
+            break;
+        case CMD_IDLE:
+            emu_run(cmd->cycles);
+            reached += (cpu.shutdown && !cpu.int_pending);
+            break;
+        case CMD_PC:
+            reached += emu_run_until(cmd->value, cmd->cycles);
+            break;
+        case CMD_SCREEN:
+            reached += run_screen(cmd->value, cmd->cycles);
+            break;
+        }
+    }
+    return reached;
+}
+
+static uint64_t host_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void run_engine(const ENGINE *engine) {
+    int checkpoints = 0;
+    for (int i = 0; i < command_count; i++)
+        checkpoints += (commands[i].type >= CMD_IDLE);
+
+    exec_fusion = engine->fusion;
+    idiom_enable = engine->idiom;
+    exec_direct = engine->direct;
+    emu_init();
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t ticks = host_ticks();
+    int reached = run_script();
+    ticks = host_ticks() - ticks;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double wall = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    double guest = (double)cpu.cycles / CPU_CLOCK;
+    double insns = cpu.insns ? (double)cpu.insns : 1.0;
+    // Without a cycle counter the host cycles per instruction read 0
+    printf("bench engine=%s cycles=%llu insns=%llu wall_s=%.6f "
+            "speedup=%.3f guest_ips=%.0f host_cpi=%.2f checkpoints=%d/%d "
+            "pc=%05x screen=%08x\n", engine->name,
+            (unsigned long long)cpu.cycles, (unsigned long long)cpu.insns,
+            wall, (wall > 0) ? guest / wall : 0.0,
+            (wall > 0) ? cpu.insns / wall : 0.0, ticks / insns,
+            reached, checkpoints, cpu.pc, emu_screen_hash());
+}
+
+// Run the script in fn with every engine, or only the named one. Returns
+// false if the script can not be read or the engine does not exist.
+bool bench_run(const char *fn, const char *engine) {
+    if (!parse(fn))
+        return false;
+    bool fusion = exec_fusion, idiom = idiom_enable, direct = exec_direct;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (engine && strcmp(engine, engines[i].name))
+            continue;
+        run_engine(&engines[i]);
+        found = true;
+    }
+    exec_fusion = fusion;
+    idiom_enable = idiom;
+    exec_direct = direct;
+    return found;
+}
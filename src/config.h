@@ -27,3 +27,12 @@
 
 #define SCR_X           131
 #define SCR_Y           80
+
+#define ADDR_MASK       0xfffff // Saturn addresses are 20 bits, in nibbles
+#define RAM_NIBBLES     (256 * 1024) // Size of the system RAM module
+
+// RAM layout, 0 for one nibble per byte, 1 for two, see ram.c. Set with
+// make RAM_PACKED=1 after a make clean.
+#ifndef RAM_PACKED
+#define RAM_PACKED      0
+#endif
@@ -0,0 +1,83 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "disasm.h"
+#include "translate.h"
+#include "constptr.h"
+
+// Forward propagation of constant D0 / D1 values through a translated block.
+// Both pointers are unknown at block entry, become known through D0=HEX /
+// D1=HEX and stay known through D0=D0+n and friends. Memory accesses through
+// a known pointer get UF_CONST_PTR with the address in imm, exec_prepare()
+// then binds them to the module the address maps to.
+//
+// Only the address is worked out here, it does not depend on the bus
+// configuration, so blocks can still be shared through the translation
+// cache.
+
+void constptr_block(BLOCK *block) {
+    bool known[2] = { false, false };
+    uint32_t value[2] = { 0, 0 };
+    for (int i = 0; i < block->count; i++) {
+        UOP *u = &block->uop[i];
+        int d;
+        switch (u->op) {
+        case UOP_DSET:
+            // D0=(2) and D0=(4) only replace the low nibbles
+            if (u->src >= 5) {
+                known[u->dst] = true;
+                value[u->dst] = u->imm;
+            }
+            else {
+                uint32_t m = (1u << (u->src * 4)) - 1;
+                value[u->dst] = (value[u->dst] & ~m) | u->imm;
+            }
+            break;
+        case UOP_DADD:
+            value[u->dst] = (value[u->dst] + u->imm) & ADDR_MASK;
+            break;
+        case UOP_DSUB:
+            value[u->dst] = (value[u->dst] - u->imm) & ADDR_MASK;
+            break;
+        case UOP_DCOPY:
+        case UOP_DEXCH:
+            known[u->dst] = false;
+            break;
+        case UOP_LOAD:
+        case UOP_STORE:
+            d = (u->op == UOP_LOAD) ? u->src : u->dst;
+            // P and WP accesses have a length only known at run time
+            if (known[d] && (u->field != F_P) && (u->field != F_WP)) {
+                u->flags |= UF_CONST_PTR;
+                u->imm = value[d];
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
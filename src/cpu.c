@@ -24,16 +24,152 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "config.h"
-#include "rom.h"
+#include "util.h"
+#include "disasm.h"
+#include "memory.h"
+#include "translate.h"
+#include "exec.h"
+#include "tcache.h"
+#include "trace.h"
+#include "hle.h"
 #include "cpu.h"
 
+// Translated blocks are allocated from a fixed pool and looked up by entry
+// address. Blocks are never freed individually: invalidated blocks are only
+// unlinked, and the whole pool is recycled by cpu_flush_blocks().
+
+#define BLOCK_POOL_SIZE     (16384)
+#define INT_VECTOR          (0x0000f)
+
 CPU_STATE cpu;
 
+static BLOCK block_pool[BLOCK_POOL_SIZE];
+static int block_pool_used;
+static BLOCK *block_map[ADDR_MASK + 1];
+// Blocks translated from outside of ROM, checked when their code is written
+static BLOCK *ram_blocks[BLOCK_POOL_SIZE];
+static int ram_block_count;
+
 void cpu_init() {
-    cpu.pc = 0;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu_flush_blocks();
+}
+
+void cpu_flush_blocks() {
+    for (int i = 0; i < block_pool_used; i++)
+        block_map[block_pool[i].pc] = NULL;
+    block_pool_used = 0;
+    ram_block_count = 0;
+    memset(code_page, 0, sizeof(code_page));
+}
+
+// Called when a page holding translated code is written
+void cpu_invalidate(uint32_t address) {
+    uint32_t page = address >> PAGE_SHIFT;
+    for (int i = 0; i < ram_block_count;) {
+        BLOCK *block = ram_blocks[i];
+        if ((page >= (block->pc >> PAGE_SHIFT)) &&
+                (page <= ((block->end - 1) >> PAGE_SHIFT))) {
+            if (block_map[block->pc] == block)
+                block_map[block->pc] = NULL;
+            ram_blocks[i] = ram_blocks[--ram_block_count];
+        }
+        else {
+            i++;
+        }
+    }
+    code_page[page] = 0;
+}
+
+static BLOCK *cpu_get_block(uint32_t pc) {
+    BLOCK *block = block_map[pc];
+    if (block)
+        return block;
+
+    if (block_pool_used == BLOCK_POOL_SIZE)
+        cpu_flush_blocks();
+    block = &block_pool[block_pool_used++];
+    if (!tcache_load(block, pc)) {
+        translate_block(block, pc);
+        tcache_add(block);
+    }
+    exec_prepare(block);
+    block->exec_count = 0;
+    if ((memory_map(pc) != MEM_ROM) ||
+            (memory_map((block->end - 1) & ADDR_MASK) != MEM_ROM)) {
+        memory_mark_code(pc, block->end - pc);
+        ram_blocks[ram_block_count++] = block;
+    }
+    block_map[pc] = block;
+    return block;
 }
 
 void cpu_run_block() {
+    if (cpu.int_pending && cpu.int_enable && !cpu.in_interrupt) {
+        cpu.int_pending = false;
+        cpu.in_interrupt = true;
+        cpu.shutdown = false;
+        cpu_push(cpu.pc);
+        cpu.pc = INT_VECTOR;
+    }
+
+    if (hle_active && hle_enter())
+        return;
+    if (trace_enabled)
+        trace_block(cpu.pc);
+    BLOCK *block = cpu_get_block(cpu.pc);
+    block->exec_count++;
+    exec_block(block);
+    cpu.cycles += block->cycles;
+    cpu.insns += block->insns;
+}
+
+// Write how often each sequence of 2 and 3 live uops ran, weighted by block
+// execution counts, in the format read by tools/gen_fuse.py
+void cpu_profile_dump(const char *fn) {
+    const int n = UOP_TYPE_COUNT;
+    uint64_t *pairs = calloc(n * n, sizeof(uint64_t));
+    uint64_t *triples = calloc(n * n * n, sizeof(uint64_t));
+    if (!pairs || !triples)
+        fatal("Unable to allocate profile\n");
+
+    for (int i = 0; i < block_pool_used; i++) {
+        BLOCK *block = &block_pool[i];
+        int ops[BLOCK_MAX_UOPS];
+        int count = 0;
+        for (int j = 0; j < block->count; j++) {
+            if (block->uop[j].flags & UF_DEAD) {
+                count = 0;
+                continue;
+            }
+            ops[count++] = block->uop[j].op;
+            if (count >= 2)
+                pairs[ops[count - 2] * n + ops[count - 1]] += block->exec_count;
+            if (count >= 3)
+                triples[(ops[count - 3] * n + ops[count - 2]) * n +
+                        ops[count - 1]] += block->exec_count;
+        }
+    }
 
+    FILE *fp = fopen(fn, "w");
+    if (!fp)
+        fatal("Unable to open %s\n", fn);
+    fprintf(fp, "# Uop sequence profile, %llu cycles\n",
+            (unsigned long long)cpu.cycles);
+    for (int i = 0; i < n * n; i++) {
+        if (pairs[i])
+            fprintf(fp, "%llu %s %s\n", (unsigned long long)pairs[i],
+                    uop_names[i / n], uop_names[i % n]);
+    }
+    for (int i = 0; i < n * n * n; i++) {
+        if (triples[i])
+            fprintf(fp, "%llu %s %s %s\n", (unsigned long long)triples[i],
+                    uop_names[i / (n * n)], uop_names[(i / n) % n],
+                    uop_names[i % n]);
+    }
+    fclose(fp);
+    free(pairs);
+    free(triples);
 }
@@ -22,9 +22,56 @@
 //
 #pragma once
 
+#define RSTK_DEPTH      (8)
+
+// HST bits
+#define HST_XM          (0x1)
+#define HST_SB          (0x2)
+#define HST_SR          (0x4)
+#define HST_MP          (0x8)
+
 typedef struct {
+    uint64_t reg[4];    // A, B, C, D, indexed by R_*
+    uint64_t r[5];      // Scratch registers R0-R4
+    uint32_t d[2];      // Pointer registers D0, D1
     uint32_t pc;
+    uint8_t p;
+    uint16_t st;
+    uint8_t hst;
+    bool carry;
+    bool dec;           // Decimal mode
+    uint32_t rstk[RSTK_DEPTH];
+    int rstk_count;
+    uint16_t in;
+    uint16_t out;
+    bool int_enable;
+    bool int_pending;
+    bool in_interrupt;
+    bool shutdown;
+    uint64_t cycles;
+    uint64_t insns;     // Instructions run, counted by whole blocks as cycles
 } CPU_STATE;
 
+extern CPU_STATE cpu;
+
+static inline void cpu_push(uint32_t address) {
+    if (cpu.rstk_count == RSTK_DEPTH) {
+        // Oldest level is lost
+        for (int i = 0; i < RSTK_DEPTH - 1; i++)
+            cpu.rstk[i] = cpu.rstk[i + 1];
+        cpu.rstk_count--;
+    }
+    cpu.rstk[cpu.rstk_count++] = address & ADDR_MASK;
+}
+
+static inline uint32_t cpu_pop() {
+    if (cpu.rstk_count == 0)
+        return 0;
+    return cpu.rstk[--cpu.rstk_count];
+}
+
 void cpu_init();
 void cpu_run_block();
+void cpu_flush_blocks();
+void cpu_invalidate(uint32_t address);
+void cpu_profile_dump(const char *fn);
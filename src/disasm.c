@@ -27,20 +27,11 @@
 #include <string.h>
 #include "config.h"
 #include "util.h"
-#include "rom.h"
+#include "memory.h"
 #include "disasm.h"
 
 // Use directly with a, field beyond 7 are used internally
 char *field[9] = {"P", "WP", "XS", "X", "S", "M", "B", "W", "A"};
-#define F_P     0
-#define F_WP    1
-#define F_XS    2
-#define F_X     3
-#define F_S     4
-#define F_M     5
-#define F_B     6
-#define F_W     7
-#define F_A     8
 
 #define SET_INFO(m,l) { strcpy(instr->disasm, m); instr->length = l; }
 #define SET_INFO_A(m,v,l) { sprintf(instr->disasm, "%s %s", m, field[v]); instr->length = l; }
@@ -60,7 +51,7 @@ static uint64_t get_imm(DISASM *instr, int offset, int length) {
     uint8_t *op_ptr = &(instr->opcode[offset]);
     uint64_t imm = 0;
     for (int i = 0; i < length; i++) {
-        imm |= (*op_ptr++) << (i * 4);
+        imm |= (uint64_t)(*op_ptr++) << (i * 4);
     }
     return imm;
 }
@@ -79,6 +70,12 @@ static void print_godst8(char *dst, uint8_t value, int offset) {
     }
 }
 
+// Field selector in the fs encoding, 0xF selects the A field. Values 8-E are
+// undefined and decoded the same way.
+static int get_fs(uint8_t value) {
+    return (value > 7) ? F_A : value;
+}
+
 static int get_s16(uint64_t value) {
     uint16_t v16 = value & 0xffff;
     int val = (int)((int16_t)v16);
@@ -104,7 +101,7 @@ void disasm(DISASM *instr, uint32_t pc) {
     char ftemp[20];
     uint8_t ntemp;
     for (int i = 0; i < INSTR_MAX_LENGTH; i++)
-        instr->opcode[i] = rom_read(pc++);
+        instr->opcode[i] = memory_read_nibble(pc++);
     switch (instr->opcode[0]) {
     case 0x0: // Misc operations
         switch (instr->opcode[1]) {
@@ -124,22 +121,22 @@ void disasm(DISASM *instr, uint32_t pc) {
         case 0xD: SET_INFO("P=P-1", 2); break;
         case 0xE:
             switch (instr->opcode[3]) {
-            case 0x0: SET_INFO_A("A=A&B", instr->opcode[2], 4); break;
-            case 0x1: SET_INFO_A("B=B&C", instr->opcode[2], 4); break;
-            case 0x2: SET_INFO_A("C=C&A", instr->opcode[2], 4); break;
-            case 0x3: SET_INFO_A("D=D&C", instr->opcode[2], 4); break;
-            case 0x4: SET_INFO_A("B=B&A", instr->opcode[2], 4); break;
-            case 0x5: SET_INFO_A("C=C&B", instr->opcode[2], 4); break;
-            case 0x6: SET_INFO_A("A=A&C", instr->opcode[2], 4); break;
-            case 0x7: SET_INFO_A("C=C&D", instr->opcode[2], 4); break;
-            case 0x8: SET_INFO_A("A=A!B", instr->opcode[2], 4); break;
-            case 0x9: SET_INFO_A("B=B!C", instr->opcode[2], 4); break;
-            case 0xA: SET_INFO_A("C=C!A", instr->opcode[2], 4); break;
-            case 0xB: SET_INFO_A("D=D!C", instr->opcode[2], 4); break;
-            case 0xC: SET_INFO_A("B=B!A", instr->opcode[2], 4); break;
-            case 0xD: SET_INFO_A("C=C!B", instr->opcode[2], 4); break;
-            case 0xE: SET_INFO_A("A=A!C", instr->opcode[2], 4); break;
-            case 0xF: SET_INFO_A("C=C!D", instr->opcode[2], 4); break;
+            case 0x0: SET_INFO_A("A=A&B", get_fs(instr->opcode[2]), 4); break;
+            case 0x1: SET_INFO_A("B=B&C", get_fs(instr->opcode[2]), 4); break;
+            case 0x2: SET_INFO_A("C=C&A", get_fs(instr->opcode[2]), 4); break;
+            case 0x3: SET_INFO_A("D=D&C", get_fs(instr->opcode[2]), 4); break;
+            case 0x4: SET_INFO_A("B=B&A", get_fs(instr->opcode[2]), 4); break;
+            case 0x5: SET_INFO_A("C=C&B", get_fs(instr->opcode[2]), 4); break;
+            case 0x6: SET_INFO_A("A=A&C", get_fs(instr->opcode[2]), 4); break;
+            case 0x7: SET_INFO_A("C=C&D", get_fs(instr->opcode[2]), 4); break;
+            case 0x8: SET_INFO_A("A=A!B", get_fs(instr->opcode[2]), 4); break;
+            case 0x9: SET_INFO_A("B=B!C", get_fs(instr->opcode[2]), 4); break;
+            case 0xA: SET_INFO_A("C=C!A", get_fs(instr->opcode[2]), 4); break;
+            case 0xB: SET_INFO_A("D=D!C", get_fs(instr->opcode[2]), 4); break;
+            case 0xC: SET_INFO_A("B=B!A", get_fs(instr->opcode[2]), 4); break;
+            case 0xD: SET_INFO_A("C=C!B", get_fs(instr->opcode[2]), 4); break;
+            case 0xE: SET_INFO_A("A=A!C", get_fs(instr->opcode[2]), 4); break;
+            case 0xF: SET_INFO_A("C=C!D", get_fs(instr->opcode[2]), 4); break;
             }
             break;
         case 0xF: SET_INFO("RTI", 2); break;
@@ -234,7 +231,7 @@ void disasm(DISASM *instr, uint32_t pc) {
             }
             else if (instr->opcode[1] == 0x5) {
                 if (!(instr->opcode[2] & 0x8)) {
-                    SET_INFO_A(ptemp, instr->opcode[3], 4);
+                    SET_INFO_A(ptemp, get_fs(instr->opcode[3]), 4);
                 }
                 else {
                     SET_INFO_X(ptemp, instr->opcode[3], 4);
@@ -337,6 +334,61 @@ void disasm(DISASM *instr, uint32_t pc) {
             case 0x5: SET_INFO("BSRC", 3); break;
             case 0x6: SET_INFO("CSRC", 3); break;
             case 0x7: SET_INFO("DSRC", 3); break;
+            case 0x8:
+                switch (instr->opcode[4]) {
+                case 0x0: ptemp = "A=A+CON"; break;
+                case 0x1: ptemp = "B=B+CON"; break;
+                case 0x2: ptemp = "C=C+CON"; break;
+                case 0x3: ptemp = "D=D+CON"; break;
+                case 0x8: ptemp = "A=A-CON"; break;
+                case 0x9: ptemp = "B=B-CON"; break;
+                case 0xA: ptemp = "C=C-CON"; break;
+                case 0xB: ptemp = "D=D-CON"; break;
+                default: ptemp = NULL; break;
+                }
+                if (ptemp) {
+                    sprintf(instr->disasm, "%s %s %d", ptemp,
+                            field[get_fs(instr->opcode[3])], instr->opcode[5] + 1);
+                    instr->length = 6;
+                }
+                else {
+                    ILLEGAL_INSN();
+                }
+                break;
+            case 0x9:
+                switch (instr->opcode[4]) {
+                case 0x0: SET_INFO_A("ASRB", get_fs(instr->opcode[3]), 5); break;
+                case 0x1: SET_INFO_A("BSRB", get_fs(instr->opcode[3]), 5); break;
+                case 0x2: SET_INFO_A("CSRB", get_fs(instr->opcode[3]), 5); break;
+                case 0x3: SET_INFO_A("DSRB", get_fs(instr->opcode[3]), 5); break;
+                default: ILLEGAL_INSN(); break;
+                }
+                break;
+            case 0xA:
+                ntemp = instr->opcode[5];
+                if ((instr->opcode[4] > 2) || ((ntemp & 0x7) > 4)) {
+                    ILLEGAL_INSN();
+                    break;
+                }
+                switch (instr->opcode[4]) {
+                case 0x0: sprintf(ftemp, "R%d=%c", ntemp & 0x7, (ntemp & 0x8) ? 'C' : 'A'); break;
+                case 0x1: sprintf(ftemp, "%c=R%d", (ntemp & 0x8) ? 'C' : 'A', ntemp & 0x7); break;
+                case 0x2: sprintf(ftemp, "%cR%dEX", (ntemp & 0x8) ? 'C' : 'A', ntemp & 0x7); break;
+                }
+                sprintf(instr->disasm, "%s %s", ftemp, field[get_fs(instr->opcode[3])]);
+                instr->length = 6;
+                break;
+            case 0xB:
+                switch (instr->opcode[3]) {
+                case 0x2: SET_INFO("PC=A", 4); break;
+                case 0x3: SET_INFO("PC=C", 4); break;
+                case 0x4: SET_INFO("A=PC", 4); break;
+                case 0x5: SET_INFO("C=PC", 4); break;
+                case 0x6: SET_INFO("APCEX", 4); break;
+                case 0x7: SET_INFO("CPCEX", 4); break;
+                default: ILLEGAL_INSN(); break;
+                }
+                break;
             case 0xC: SET_INFO("ASRB", 3); break;
             case 0xD: SET_INFO("BSRB", 3); break;
             case 0xE: SET_INFO("CSRB", 3); break;
@@ -25,6 +25,18 @@
 #define INSTR_MAX_LENGTH    (21) // Maximum instruction length, in nibbles
 #define INSTR_MAX_DISASM    (32) // Maximum disassembly string length
 
+// Field selectors, as encoded in the instruction. Fields beyond 7 are used
+// internally
+#define F_P     0
+#define F_WP    1
+#define F_XS    2
+#define F_X     3
+#define F_S     4
+#define F_M     5
+#define F_B     6
+#define F_W     7
+#define F_A     8
+
 typedef struct {
     uint8_t length;
     uint8_t opcode[INSTR_MAX_LENGTH]; // One nibble per byte (low 4 bits only)
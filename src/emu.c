@@ -26,16 +26,95 @@
 #include <stdint.h>
 #include "config.h"
 #include "memory.h"
+#include "io.h"
 #include "disasm.h"
+#include "translate.h"
+#include "cpu.h"
+#include "rewind.h"
+#include "sample.h"
+#include "emu.h"
 
-// Main function in platform source code
+// Main functions in platform source code
 
-void emu_main() {
-    uint32_t pc = 0;
+#define SCR_BASE_REG    (0x20) // Display start address, I/O offset
+#define SCR_LINES       (64)
+#define SCR_STRIDE      (34) // Nibbles per line, 131 pixels padded to bytes
+
+void emu_init() {
+    memory_init();
+    cpu_init();
+}
+
+// Run until the given number of cycles elapsed, or the CPU shuts down with
+// no interrupt to wake it up
+void emu_run(uint64_t cycles) {
+    uint64_t end = cpu.cycles + cycles;
+    while (cpu.cycles < end) {
+        if (cpu.shutdown && !cpu.int_pending)
+            break;
+        cpu_run_block();
+        if (cpu.cycles >= rewind_next)
+            rewind_capture();
+        if (cpu.cycles >= sample_next)
+            sample_capture();
+    }
+}
+
+// Same as emu_run(), also stopping when a block starts at pc. Returns true
+// if pc was reached.
+bool emu_run_until(uint32_t pc, uint64_t cycles) {
+    uint64_t end = cpu.cycles + cycles;
+    while (cpu.cycles < end) {
+        if (cpu.pc == pc)
+            return true;
+        if (cpu.shutdown && !cpu.int_pending)
+            break;
+        cpu_run_block();
+        if (cpu.cycles >= rewind_next)
+            rewind_capture();
+        if (cpu.cycles >= sample_next)
+            sample_capture();
+    }
+    return cpu.pc == pc;
+}
+
+// FNV-1a hash of the display bitmap, which starts at the address held in the
+// I/O register at #00120 and has SCR_LINES lines of SCR_STRIDE nibbles. The
+// line offset register is ignored.
+uint32_t emu_screen_hash() {
+    uint32_t base = 0;
+    for (int i = 0; i < 5; i++)
+        base |= (uint32_t)io_read(SCR_BASE_REG + i) << (i * 4);
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < SCR_LINES * SCR_STRIDE; i++) {
+        hash ^= memory_read_nibble(base + i);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Print translated blocks starting from pc, with liveness results
+void emu_list(uint32_t pc, int count) {
     DISASM instr;
-    for (int i = 0; i < 200; i++) {
-        disasm(&instr, pc);
-        printf("PC %04x: %s\n", pc, instr.disasm);
-        pc += instr.length;
+    BLOCK block;
+    for (int i = 0; i < count;) {
+        translate_block(&block, pc);
+        bool loop = (block.uop[0].op == UOP_LOOP);
+        for (int j = loop ? 1 : 0; j < block.count; j++, i++) {
+            disasm(&instr, pc);
+            const UOP *u = &block.uop[j];
+            printf("PC %04x: %-24s", pc, instr.disasm);
+            if (u->flags & UF_DEAD)
+                printf(" ; dead");
+            else if (u->flags & UF_NO_CARRY)
+                printf(" ; no carry");
+            else if (u->flags & UF_CONST_PTR)
+                printf(" ; at %05x", (uint32_t)u->imm);
+            printf("\n");
+            pc += instr.length;
+        }
+        printf("BLOCK %05x-%05x: %d uops, %d carry and %d dead removed%s\n",
+                block.pc, block.end, block.count, block.carry_elided,
+                block.dead_elided, loop ? ", loop idiom" : "");
     }
 }
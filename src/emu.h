@@ -22,4 +22,8 @@
 //
 #pragma once
 
-void emu_main();
+void emu_init();
+void emu_run(uint64_t cycles);
+bool emu_run_until(uint32_t pc, uint64_t cycles);
+uint32_t emu_screen_hash();
+void emu_list(uint32_t pc, int count);
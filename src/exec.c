@@ -0,0 +1,1102 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "util.h"
+#include "disasm.h"
+#include "memory.h"
+#include "ram.h"
+#include "rom.h"
+#include "io.h"
+#include "translate.h"
+#include "cpu.h"
+#include "idiom.h"
+#include "exec.h"
+
+// Uop interpreter. Each uop type has a handler working on the global CPU
+// state, uops working on a register field get one handler per field, and
+// adjacent uops listed in fuse_table.h get a fused handler so they run with
+// a single dispatch.
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// Use fused handlers when preparing blocks
+bool exec_fusion = true;
+// Bind accesses through constant pointers to their module
+bool exec_direct = true;
+
+// First nibble and length of each field, P and WP depend on P at run time
+static const uint8_t field_lo[F_COUNT] = {
+    0, 0, 2, 0, 15, 3, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+static const uint8_t field_n[F_COUNT] = {
+    1, 1, 1, 3, 1, 12, 2, 16, 5,
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+};
+
+ALWAYS_INLINE void get_field(int field, int *lo, int *n) {
+    if (field == F_P) {
+        *lo = cpu.p;
+        *n = 1;
+    }
+    else if (field == F_WP) {
+        *lo = 0;
+        *n = cpu.p + 1;
+    }
+    else {
+        *lo = field_lo[field];
+        *n = field_n[field];
+    }
+}
+
+ALWAYS_INLINE uint64_t nib_mask(int n) {
+    return (n >= 16) ? ~(uint64_t)0 : (((uint64_t)1 << (n * 4)) - 1);
+}
+
+ALWAYS_INLINE uint64_t get_bits(uint64_t v, int lo, int n) {
+    return (v >> (lo * 4)) & nib_mask(n);
+}
+
+ALWAYS_INLINE uint64_t set_bits(uint64_t v, uint64_t x, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    return (v & ~m) | ((x << (lo * 4)) & m);
+}
+
+// Add over n nibbles, in decimal mode each nibble is a BCD digit
+ALWAYS_INLINE uint64_t alu_add(uint64_t x, uint64_t y, int n, bool dec,
+        bool *carry) {
+    if (!dec) {
+        uint64_t s = x + y;
+        *carry = (n == 16) ? (s < x) : (s > nib_mask(n));
+        return s & nib_mask(n);
+    }
+    uint64_t r = 0;
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        int d = ((x >> (i * 4)) & 0xf) + ((y >> (i * 4)) & 0xf) + c;
+        c = (d >= 10);
+        if (c)
+            d -= 10;
+        r |= (uint64_t)(d & 0xf) << (i * 4);
+    }
+    *carry = c;
+    return r;
+}
+
+ALWAYS_INLINE uint64_t alu_sub(uint64_t x, uint64_t y, int n, bool dec,
+        bool *carry) {
+    if (!dec) {
+        *carry = x < y;
+        return (x - y) & nib_mask(n);
+    }
+    uint64_t r = 0;
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        int d = ((x >> (i * 4)) & 0xf) - ((y >> (i * 4)) & 0xf) - c;
+        c = (d < 0);
+        if (c)
+            d += 10;
+        r |= (uint64_t)(d & 0xf) << (i * 4);
+    }
+    *carry = c;
+    return r;
+}
+
+// One's complement, nine's complement in decimal mode
+ALWAYS_INLINE uint64_t alu_not(uint64_t x, int n, bool dec) {
+    if (!dec)
+        return x ^ nib_mask(n);
+    uint64_t r = 0;
+    for (int i = 0; i < n; i++)
+        r |= (uint64_t)((9 - ((x >> (i * 4)) & 0xf)) & 0xf) << (i * 4);
+    return r;
+}
+
+ALWAYS_INLINE uint32_t next_pc(const UOP *u) {
+    return (u->pc + u->length) & ADDR_MASK;
+}
+
+// Leave the block, to target if cond is true, or to the next instruction
+ALWAYS_INLINE int jump_if(const UOP *u, bool cond, uint32_t target) {
+    cpu.pc = cond ? target : next_pc(u);
+    return 1;
+}
+
+// Conditional part of test instructions: set carry, then GOYES or RTNYES
+ALWAYS_INLINE int goyes(const UOP *u, bool cond) {
+    cpu.carry = cond;
+    if (cond && (u->flags & UF_RTNYES))
+        cpu.pc = cpu_pop();
+    else
+        cpu.pc = cond ? u->target : next_pc(u);
+    return 1;
+}
+
+// Working register arithmetic. Operations on a register field are written
+// once as name_f(u, lo, n) and instantiated for each field further down, so
+// the field position and masks are constants in the handlers.
+
+ALWAYS_INLINE int add_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    uint64_t y = get_bits(cpu.reg[u->src], lo, n);
+    x = alu_add(x, y, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int sub_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    uint64_t y = get_bits(cpu.reg[u->src], lo, n);
+    x = alu_sub(x, y, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int rsub_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    uint64_t y = get_bits(cpu.reg[u->src], lo, n);
+    x = alu_sub(y, x, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int inc_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_add(x, 1, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int dec_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_sub(x, 1, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+// A=A+CON and A=A-CON always work in hexadecimal
+ALWAYS_INLINE int addcon_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_add(x, u->imm, n, false, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int subcon_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_sub(x, u->imm, n, false, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+// Two's complement, carry is set unless the field was 0
+ALWAYS_INLINE int neg_body(const UOP *u, int lo, int n, bool set_carry) {
+    bool c;
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_sub(0, x, n, cpu.dec, &c);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+// One's complement, always clears carry
+ALWAYS_INLINE int not_body(const UOP *u, int lo, int n, bool set_carry) {
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    x = alu_not(x, n, cpu.dec);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    if (set_carry)
+        cpu.carry = false;
+    return 0;
+}
+
+ALWAYS_INLINE int and_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    cpu.reg[u->dst] &= cpu.reg[u->src] | ~m;
+    return 0;
+}
+
+ALWAYS_INLINE int or_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    cpu.reg[u->dst] |= cpu.reg[u->src] & m;
+    return 0;
+}
+
+ALWAYS_INLINE int zero_f(const UOP *u, int lo, int n) {
+    cpu.reg[u->dst] &= ~(nib_mask(n) << (lo * 4));
+    return 0;
+}
+
+ALWAYS_INLINE int copy_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    cpu.reg[u->dst] = (cpu.reg[u->dst] & ~m) | (cpu.reg[u->src] & m);
+    return 0;
+}
+
+ALWAYS_INLINE int exch_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    uint64_t t = (cpu.reg[u->dst] ^ cpu.reg[u->src]) & m;
+    cpu.reg[u->dst] ^= t;
+    cpu.reg[u->src] ^= t;
+    return 0;
+}
+
+ALWAYS_INLINE int sl_f(const UOP *u, int lo, int n) {
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x << 4, lo, n);
+    return 0;
+}
+
+// Right shifts set SB if non-zero bits are shifted out
+ALWAYS_INLINE int sr_f(const UOP *u, int lo, int n) {
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    if (x & 0xf)
+        cpu.hst |= HST_SB;
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x >> 4, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int srb_f(const UOP *u, int lo, int n) {
+    uint64_t x = get_bits(cpu.reg[u->dst], lo, n);
+    if (x & 0x1)
+        cpu.hst |= HST_SB;
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x >> 1, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int op_slc(const UOP *u) {
+    uint64_t x = cpu.reg[u->dst];
+    cpu.reg[u->dst] = (x << 4) | (x >> 60);
+    return 0;
+}
+
+ALWAYS_INLINE int op_src(const UOP *u) {
+    uint64_t x = cpu.reg[u->dst];
+    if (x & 0xf)
+        cpu.hst |= HST_SB;
+    cpu.reg[u->dst] = (x >> 4) | (x << 60);
+    return 0;
+}
+
+// Register tests
+
+#define TEST_OP(name, expr) \
+    ALWAYS_INLINE int name##_f(const UOP *u, int lo, int n) { \
+        uint64_t x = get_bits(cpu.reg[u->dst], lo, n); \
+        uint64_t y = get_bits(cpu.reg[u->src], lo, n); \
+        (void)y; \
+        return goyes(u, expr); \
+    }
+
+TEST_OP(teq, x == y)
+TEST_OP(tne, x != y)
+TEST_OP(tz, x == 0)
+TEST_OP(tnz, x != 0)
+TEST_OP(tgt, x > y)
+TEST_OP(tlt, x < y)
+TEST_OP(tge, x >= y)
+TEST_OP(tle, x <= y)
+
+// Scratch registers
+
+ALWAYS_INLINE int rsto_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    cpu.r[u->imm] = (cpu.r[u->imm] & ~m) | (cpu.reg[u->src] & m);
+    return 0;
+}
+
+ALWAYS_INLINE int rlod_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    cpu.reg[u->dst] = (cpu.reg[u->dst] & ~m) | (cpu.r[u->imm] & m);
+    return 0;
+}
+
+ALWAYS_INLINE int rexc_f(const UOP *u, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    uint64_t t = (cpu.reg[u->dst] ^ cpu.r[u->imm]) & m;
+    cpu.reg[u->dst] ^= t;
+    cpu.r[u->imm] ^= t;
+    return 0;
+}
+
+// Memory transfers, register nibble lo goes to or from the pointer address
+
+ALWAYS_INLINE int load_f(const UOP *u, int lo, int n) {
+    uint64_t x = memory_read(cpu.d[u->src], n);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int store_f(const UOP *u, int lo, int n) {
+    memory_write(cpu.d[u->dst], get_bits(cpu.reg[u->src], lo, n), n);
+    return 0;
+}
+
+// Accesses at a constant address bound by exec_prepare(), target is the
+// offset inside the module so the bus is never looked up
+
+ALWAYS_INLINE int load_ram_f(const UOP *u, int lo, int n) {
+    uint64_t x = ram_load(u->target, n);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int load_rom_f(const UOP *u, int lo, int n) {
+    const uint8_t *p = rom_get_ptr(u->target);
+    uint64_t x = 0;
+    for (int i = 0; i < n; i++)
+        x |= (uint64_t)p[i] << (i * 4);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int load_io_f(const UOP *u, int lo, int n) {
+    uint64_t x = 0;
+    for (int i = 0; i < n; i++)
+        x |= (uint64_t)io_read(u->target + i) << (i * 4);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], x, lo, n);
+    return 0;
+}
+
+ALWAYS_INLINE int store_ram_f(const UOP *u, int lo, int n) {
+    memory_write_direct(MEM_RAM, u->imm, u->target,
+            get_bits(cpu.reg[u->src], lo, n), n);
+    return 0;
+}
+
+ALWAYS_INLINE int store_io_f(const UOP *u, int lo, int n) {
+    memory_write_direct(MEM_IO, u->imm, u->target,
+            get_bits(cpu.reg[u->src], lo, n), n);
+    return 0;
+}
+
+// Pointer registers
+
+ALWAYS_INLINE int dadd_body(const UOP *u, bool set_carry) {
+    uint32_t d = cpu.d[u->dst] + u->imm;
+    if (set_carry)
+        cpu.carry = d > ADDR_MASK;
+    cpu.d[u->dst] = d & ADDR_MASK;
+    return 0;
+}
+
+ALWAYS_INLINE int dsub_body(const UOP *u, bool set_carry) {
+    uint32_t d = cpu.d[u->dst];
+    if (set_carry)
+        cpu.carry = d < u->imm;
+    cpu.d[u->dst] = (d - u->imm) & ADDR_MASK;
+    return 0;
+}
+
+ALWAYS_INLINE int op_dset(const UOP *u) {
+    uint32_t m = nib_mask(u->src);
+    cpu.d[u->dst] = (cpu.d[u->dst] & ~m) | u->imm;
+    return 0;
+}
+
+ALWAYS_INLINE int op_dcopy(const UOP *u) {
+    uint32_t m = nib_mask(u->imm);
+    cpu.d[u->dst] = (cpu.d[u->dst] & ~m) | (cpu.reg[u->src] & m);
+    return 0;
+}
+
+ALWAYS_INLINE int op_dexch(const UOP *u) {
+    uint32_t m = nib_mask(u->imm);
+    uint32_t t = (cpu.d[u->dst] ^ cpu.reg[u->src]) & m;
+    cpu.d[u->dst] ^= t;
+    cpu.reg[u->src] ^= t;
+    return 0;
+}
+
+// P register
+
+ALWAYS_INLINE int op_pset(const UOP *u) {
+    cpu.p = u->imm;
+    return 0;
+}
+
+ALWAYS_INLINE int pinc_body(const UOP *u, bool set_carry) {
+    if (set_carry)
+        cpu.carry = (cpu.p == 15);
+    cpu.p = (cpu.p + 1) & 0xf;
+    return 0;
+}
+
+ALWAYS_INLINE int pdec_body(const UOP *u, bool set_carry) {
+    if (set_carry)
+        cpu.carry = (cpu.p == 0);
+    cpu.p = (cpu.p - 1) & 0xf;
+    return 0;
+}
+
+ALWAYS_INLINE int op_tpeq(const UOP *u) {
+    return goyes(u, cpu.p == u->imm);
+}
+
+ALWAYS_INLINE int op_tpne(const UOP *u) {
+    return goyes(u, cpu.p != u->imm);
+}
+
+ALWAYS_INLINE int op_ptoc(const UOP *u) {
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], cpu.p, u->imm, 1);
+    return 0;
+}
+
+ALWAYS_INLINE int op_ctop(const UOP *u) {
+    cpu.p = get_bits(cpu.reg[R_C], u->imm, 1);
+    return 0;
+}
+
+ALWAYS_INLINE int op_cpex(const UOP *u) {
+    uint8_t p = cpu.p;
+    cpu.p = get_bits(cpu.reg[R_C], u->imm, 1);
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], p, u->imm, 1);
+    return 0;
+}
+
+// C+P+1 always works in hexadecimal
+ALWAYS_INLINE int cpp1_body(const UOP *u, bool set_carry) {
+    bool c;
+    uint64_t x = alu_add(get_bits(cpu.reg[R_C], 0, 5), cpu.p + 1, 5, false, &c);
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], x, 0, 5);
+    if (set_carry)
+        cpu.carry = c;
+    return 0;
+}
+
+ALWAYS_INLINE int op_lhex(const UOP *u) {
+    uint64_t x = cpu.reg[u->dst];
+    for (int i = 0; i < u->src; i++)
+        x = set_bits(x, u->imm >> (i * 4), (cpu.p + i) & 0xf, 1);
+    cpu.reg[u->dst] = x;
+    return 0;
+}
+
+// Status bits
+
+ALWAYS_INLINE int op_clrst(const UOP *u) {
+    cpu.st &= 0xf000;
+    return 0;
+}
+
+ALWAYS_INLINE int op_cst(const UOP *u) {
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], cpu.st, 0, 3);
+    return 0;
+}
+
+ALWAYS_INLINE int op_stc(const UOP *u) {
+    cpu.st = (cpu.st & 0xf000) | (cpu.reg[R_C] & 0xfff);
+    return 0;
+}
+
+ALWAYS_INLINE int op_cstex(const UOP *u) {
+    uint16_t st = cpu.st;
+    cpu.st = (cpu.st & 0xf000) | (cpu.reg[R_C] & 0xfff);
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], st, 0, 3);
+    return 0;
+}
+
+ALWAYS_INLINE int op_st0(const UOP *u) {
+    cpu.st &= ~(1u << u->imm);
+    return 0;
+}
+
+ALWAYS_INLINE int op_st1(const UOP *u) {
+    cpu.st |= 1u << u->imm;
+    return 0;
+}
+
+ALWAYS_INLINE int op_tst0(const UOP *u) {
+    return goyes(u, !(cpu.st & (1u << u->imm)));
+}
+
+ALWAYS_INLINE int op_tst1(const UOP *u) {
+    return goyes(u, !!(cpu.st & (1u << u->imm)));
+}
+
+ALWAYS_INLINE int op_clrhs(const UOP *u) {
+    cpu.hst &= ~u->imm;
+    return 0;
+}
+
+ALWAYS_INLINE int op_ths0(const UOP *u) {
+    return goyes(u, !(cpu.hst & u->imm));
+}
+
+ALWAYS_INLINE int op_sethex(const UOP *u) {
+    cpu.dec = false;
+    return 0;
+}
+
+ALWAYS_INLINE int op_setdec(const UOP *u) {
+    cpu.dec = true;
+    return 0;
+}
+
+ALWAYS_INLINE int op_bit0(const UOP *u) {
+    cpu.reg[u->dst] &= ~((uint64_t)1 << u->imm);
+    return 0;
+}
+
+ALWAYS_INLINE int op_bit1(const UOP *u) {
+    cpu.reg[u->dst] |= (uint64_t)1 << u->imm;
+    return 0;
+}
+
+ALWAYS_INLINE int op_tbit0(const UOP *u) {
+    return goyes(u, !(cpu.reg[u->dst] & ((uint64_t)1 << u->imm)));
+}
+
+ALWAYS_INLINE int op_tbit1(const UOP *u) {
+    return goyes(u, !!(cpu.reg[u->dst] & ((uint64_t)1 << u->imm)));
+}
+
+// Control flow
+
+ALWAYS_INLINE int op_goto(const UOP *u) {
+    cpu.pc = u->target;
+    return 1;
+}
+
+ALWAYS_INLINE int op_gosub(const UOP *u) {
+    cpu_push(next_pc(u));
+    cpu.pc = u->target;
+    return 1;
+}
+
+ALWAYS_INLINE int op_goc(const UOP *u) {
+    return jump_if(u, cpu.carry, u->target);
+}
+
+ALWAYS_INLINE int op_gonc(const UOP *u) {
+    return jump_if(u, !cpu.carry, u->target);
+}
+
+ALWAYS_INLINE int op_rtn(const UOP *u) {
+    cpu.pc = cpu_pop();
+    return 1;
+}
+
+ALWAYS_INLINE int op_rtnsxm(const UOP *u) {
+    cpu.hst |= HST_XM;
+    return op_rtn(u);
+}
+
+ALWAYS_INLINE int op_rtnsc(const UOP *u) {
+    cpu.carry = true;
+    return op_rtn(u);
+}
+
+ALWAYS_INLINE int op_rtncc(const UOP *u) {
+    cpu.carry = false;
+    return op_rtn(u);
+}
+
+ALWAYS_INLINE int op_rtnc(const UOP *u) {
+    if (cpu.carry)
+        return op_rtn(u);
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_rtnnc(const UOP *u) {
+    if (!cpu.carry)
+        return op_rtn(u);
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_rti(const UOP *u) {
+    cpu.in_interrupt = false;
+    return op_rtn(u);
+}
+
+ALWAYS_INLINE int op_jumpi(const UOP *u) {
+    cpu.pc = memory_read(cpu.reg[R_A] & ADDR_MASK, 5);
+    return 1;
+}
+
+ALWAYS_INLINE int op_pcreg(const UOP *u) {
+    cpu.pc = cpu.reg[u->dst] & ADDR_MASK;
+    return 1;
+}
+
+ALWAYS_INLINE int op_regpc(const UOP *u) {
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], next_pc(u), 0, 5);
+    return 0;
+}
+
+ALWAYS_INLINE int op_pcex(const UOP *u) {
+    cpu.pc = cpu.reg[u->dst] & ADDR_MASK;
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], next_pc(u), 0, 5);
+    return 1;
+}
+
+ALWAYS_INLINE int op_pushc(const UOP *u) {
+    cpu_push(cpu.reg[R_C]);
+    return 0;
+}
+
+ALWAYS_INLINE int op_popc(const UOP *u) {
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], cpu_pop(), 0, 5);
+    return 0;
+}
+
+// System and I/O
+
+ALWAYS_INLINE int op_outcs(const UOP *u) {
+    cpu.out = (cpu.out & 0xff0) | (cpu.reg[R_C] & 0xf);
+    return 0;
+}
+
+ALWAYS_INLINE int op_outc(const UOP *u) {
+    cpu.out = cpu.reg[R_C] & 0xfff;
+    return 0;
+}
+
+ALWAYS_INLINE int op_in(const UOP *u) {
+    cpu.in = io_keyboard(cpu.out);
+    cpu.reg[u->dst] = set_bits(cpu.reg[u->dst], cpu.in, 0, 4);
+    return 0;
+}
+
+ALWAYS_INLINE int op_uncnfg(const UOP *u) {
+    memory_unconfig(cpu.reg[R_C] & ADDR_MASK);
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_config(const UOP *u) {
+    memory_config(cpu.reg[R_C] & ADDR_MASK);
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_cid(const UOP *u) {
+    cpu.reg[R_C] = set_bits(cpu.reg[R_C], memory_id(), 0, 5);
+    return 0;
+}
+
+ALWAYS_INLINE int op_shutdn(const UOP *u) {
+    cpu.shutdown = true;
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_inton(const UOP *u) {
+    cpu.int_enable = true;
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_intoff(const UOP *u) {
+    cpu.int_enable = false;
+    return 0;
+}
+
+ALWAYS_INLINE int op_rsi(const UOP *u) {
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_reset(const UOP *u) {
+    memory_reset();
+    cpu_flush_blocks();
+    cpu.pc = next_pc(u);
+    return 1;
+}
+
+ALWAYS_INLINE int op_sreq(const UOP *u) {
+    cpu.reg[R_C] &= ~(uint64_t)0xf;
+    return 0;
+}
+
+ALWAYS_INLINE int op_busc(const UOP *u) {
+    return 0;
+}
+
+ALWAYS_INLINE int op_illegal(const UOP *u) {
+    fatal("Illegal instruction at %05x\n", u->pc);
+    return 1;
+}
+
+// Loop idioms, imm is the cycle count of the block
+ALWAYS_INLINE int op_loop(const UOP *u) {
+    return idiom_run(u, u->imm);
+}
+
+// Uops that set carry have a second handler used when the carry is dead
+#define CARRY_OP(name) \
+    ALWAYS_INLINE int op_##name(const UOP *u) { return name##_body(u, true); } \
+    ALWAYS_INLINE int op_##name##_nc(const UOP *u) { return name##_body(u, false); }
+
+#define CARRY_FIELD_OP(name) \
+    ALWAYS_INLINE int name##_f(const UOP *u, int lo, int n) { \
+        return name##_body(u, lo, n, true); \
+    } \
+    ALWAYS_INLINE int name##_nc_f(const UOP *u, int lo, int n) { \
+        return name##_body(u, lo, n, false); \
+    }
+
+CARRY_FIELD_OP(add)
+CARRY_FIELD_OP(sub)
+CARRY_FIELD_OP(rsub)
+CARRY_FIELD_OP(inc)
+CARRY_FIELD_OP(dec)
+CARRY_FIELD_OP(addcon)
+CARRY_FIELD_OP(subcon)
+CARRY_FIELD_OP(neg)
+CARRY_FIELD_OP(not)
+CARRY_OP(dadd)
+CARRY_OP(dsub)
+CARRY_OP(pinc)
+CARRY_OP(pdec)
+CARRY_OP(cpp1)
+
+// Fields with a fixed position: handler suffix, F_* value, first nibble and
+// length. Must match field_lo and field_n.
+#define FIXED_FIELDS(X, name) \
+    X(name, xs, F_XS, 2, 1) \
+    X(name, x, F_X, 0, 3) \
+    X(name, s, F_S, 15, 1) \
+    X(name, m, F_M, 3, 12) \
+    X(name, b, F_B, 0, 2) \
+    X(name, w, F_W, 0, 16) \
+    X(name, a, F_A, 0, 5)
+
+// Counted nibble transfers, only used by LOAD and STORE
+#define COUNT_FIELDS(X, name) \
+    X(name, n1, F_N(1), 0, 1)   X(name, n2, F_N(2), 0, 2) \
+    X(name, n3, F_N(3), 0, 3)   X(name, n4, F_N(4), 0, 4) \
+    X(name, n5, F_N(5), 0, 5)   X(name, n6, F_N(6), 0, 6) \
+    X(name, n7, F_N(7), 0, 7)   X(name, n8, F_N(8), 0, 8) \
+    X(name, n9, F_N(9), 0, 9)   X(name, n10, F_N(10), 0, 10) \
+    X(name, n11, F_N(11), 0, 11) X(name, n12, F_N(12), 0, 12) \
+    X(name, n13, F_N(13), 0, 13) X(name, n14, F_N(14), 0, 14) \
+    X(name, n15, F_N(15), 0, 15) X(name, n16, F_N(16), 0, 16)
+
+#define FIELD_FUNC(name, suffix, field, lo, n) \
+    static int name##_##suffix(const UOP *u) { return name##_f(u, lo, n); }
+#define FIELD_CASE(name, suffix, field, lo, n) \
+    case field: return name##_f(u, lo, n);
+#define FIELD_ENTRY(name, suffix, field, lo, n) \
+    [field] = name##_##suffix,
+
+// Handlers of a field operation: one per field for the dispatch table, and
+// op_name for fused handlers, which switches over constant fields so each
+// case is still specialized. P and WP are the only fields resolved at run
+// time.
+#define FIELD_OP(name) \
+    static int name##_p(const UOP *u) { return name##_f(u, cpu.p, 1); } \
+    static int name##_wp(const UOP *u) { return name##_f(u, 0, cpu.p + 1); } \
+    FIXED_FIELDS(FIELD_FUNC, name) \
+    ALWAYS_INLINE int op_##name(const UOP *u) { \
+        switch (u->field) { \
+        FIXED_FIELDS(FIELD_CASE, name) \
+        default: { \
+            int lo, n; \
+            get_field(u->field, &lo, &n); \
+            return name##_f(u, lo, n); \
+        } \
+        } \
+    }
+
+#define FIELD_ROW(name) { \
+        [F_P] = name##_p, [F_WP] = name##_wp, \
+        FIXED_FIELDS(FIELD_ENTRY, name) \
+    }
+
+#define COUNT_ROW(name) { \
+        [F_P] = name##_p, [F_WP] = name##_wp, \
+        FIXED_FIELDS(FIELD_ENTRY, name) \
+        COUNT_FIELDS(FIELD_ENTRY, name) \
+    }
+
+FIELD_OP(add)
+FIELD_OP(sub)
+FIELD_OP(rsub)
+FIELD_OP(inc)
+FIELD_OP(dec)
+FIELD_OP(addcon)
+FIELD_OP(subcon)
+FIELD_OP(neg)
+FIELD_OP(not)
+FIELD_OP(add_nc)
+FIELD_OP(sub_nc)
+FIELD_OP(rsub_nc)
+FIELD_OP(inc_nc)
+FIELD_OP(dec_nc)
+FIELD_OP(addcon_nc)
+FIELD_OP(subcon_nc)
+FIELD_OP(neg_nc)
+FIELD_OP(not_nc)
+FIELD_OP(and)
+FIELD_OP(or)
+FIELD_OP(zero)
+FIELD_OP(copy)
+FIELD_OP(exch)
+FIELD_OP(sl)
+FIELD_OP(sr)
+FIELD_OP(srb)
+FIELD_OP(teq)
+FIELD_OP(tne)
+FIELD_OP(tz)
+FIELD_OP(tnz)
+FIELD_OP(tgt)
+FIELD_OP(tlt)
+FIELD_OP(tge)
+FIELD_OP(tle)
+FIELD_OP(rsto)
+FIELD_OP(rlod)
+FIELD_OP(rexc)
+FIELD_OP(load)
+FIELD_OP(store)
+COUNT_FIELDS(FIELD_FUNC, load)
+COUNT_FIELDS(FIELD_FUNC, store)
+
+// Constant address accesses, P and WP are never bound
+#define DIRECT_OP(name) \
+    FIXED_FIELDS(FIELD_FUNC, name) \
+    COUNT_FIELDS(FIELD_FUNC, name)
+
+#define DIRECT_ROW(name) { \
+        FIXED_FIELDS(FIELD_ENTRY, name) \
+        COUNT_FIELDS(FIELD_ENTRY, name) \
+    }
+
+DIRECT_OP(load_ram)
+DIRECT_OP(load_rom)
+DIRECT_OP(load_io)
+DIRECT_OP(store_ram)
+DIRECT_OP(store_io)
+
+// Generic handlers, for fused sequences and uops without a field
+static const UOP_FUNC handlers[UOP_TYPE_COUNT] = {
+    op_add, op_sub, op_rsub, op_inc, op_dec, op_addcon, op_subcon,
+    op_neg, op_not, op_and, op_or, op_zero, op_copy, op_exch,
+    op_sl, op_sr, op_srb, op_slc, op_src,
+    op_teq, op_tne, op_tz, op_tnz, op_tgt, op_tlt, op_tge, op_tle,
+    op_rsto, op_rlod, op_rexc,
+    op_load, op_store,
+    op_dadd, op_dsub, op_dset, op_dcopy, op_dexch,
+    op_pset, op_pinc, op_pdec, op_tpeq, op_tpne, op_ptoc, op_ctop,
+    op_cpex, op_cpp1,
+    op_lhex,
+    op_clrst, op_cst, op_stc, op_cstex, op_st0, op_st1, op_tst0,
+    op_tst1, op_clrhs, op_ths0, op_sethex, op_setdec,
+    op_bit0, op_bit1, op_tbit0, op_tbit1,
+    op_goto, op_gosub, op_goc, op_gonc, op_rtn, op_rtnsxm, op_rtnsc,
+    op_rtncc, op_rtnc, op_rtnnc, op_rti, op_jumpi, op_pcreg,
+    op_regpc, op_pcex, op_pushc, op_popc,
+    op_outcs, op_outc, op_in, op_uncnfg, op_config, op_cid,
+    op_shutdn, op_inton, op_intoff, op_rsi, op_reset, op_sreq,
+    op_busc, op_illegal,
+    op_loop
+};
+
+static const UOP_FUNC handlers_nc[UOP_TYPE_COUNT] = {
+    [UOP_ADD] = op_add_nc, [UOP_SUB] = op_sub_nc, [UOP_RSUB] = op_rsub_nc,
+    [UOP_INC] = op_inc_nc, [UOP_DEC] = op_dec_nc,
+    [UOP_ADDCON] = op_addcon_nc, [UOP_SUBCON] = op_subcon_nc,
+    [UOP_NEG] = op_neg_nc, [UOP_NOT] = op_not_nc,
+    [UOP_DADD] = op_dadd_nc, [UOP_DSUB] = op_dsub_nc,
+    [UOP_PINC] = op_pinc_nc, [UOP_PDEC] = op_pdec_nc,
+    [UOP_CPP1] = op_cpp1_nc
+};
+
+// Specialized handlers per (op, field), NULL for uops without a field
+static const UOP_FUNC field_handlers[UOP_TYPE_COUNT][F_COUNT] = {
+    [UOP_ADD] = FIELD_ROW(add), [UOP_SUB] = FIELD_ROW(sub),
+    [UOP_RSUB] = FIELD_ROW(rsub), [UOP_INC] = FIELD_ROW(inc),
+    [UOP_DEC] = FIELD_ROW(dec), [UOP_ADDCON] = FIELD_ROW(addcon),
+    [UOP_SUBCON] = FIELD_ROW(subcon), [UOP_NEG] = FIELD_ROW(neg),
+    [UOP_NOT] = FIELD_ROW(not), [UOP_AND] = FIELD_ROW(and),
+    [UOP_OR] = FIELD_ROW(or), [UOP_ZERO] = FIELD_ROW(zero),
+    [UOP_COPY] = FIELD_ROW(copy), [UOP_EXCH] = FIELD_ROW(exch),
+    [UOP_SL] = FIELD_ROW(sl), [UOP_SR] = FIELD_ROW(sr),
+    [UOP_SRB] = FIELD_ROW(srb),
+    [UOP_TEQ] = FIELD_ROW(teq), [UOP_TNE] = FIELD_ROW(tne),
+    [UOP_TZ] = FIELD_ROW(tz), [UOP_TNZ] = FIELD_ROW(tnz),
+    [UOP_TGT] = FIELD_ROW(tgt), [UOP_TLT] = FIELD_ROW(tlt),
+    [UOP_TGE] = FIELD_ROW(tge), [UOP_TLE] = FIELD_ROW(tle),
+    [UOP_RSTO] = FIELD_ROW(rsto), [UOP_RLOD] = FIELD_ROW(rlod),
+    [UOP_REXC] = FIELD_ROW(rexc),
+    [UOP_LOAD] = COUNT_ROW(load), [UOP_STORE] = COUNT_ROW(store)
+};
+
+static const UOP_FUNC field_handlers_nc[UOP_TYPE_COUNT][F_COUNT] = {
+    [UOP_ADD] = FIELD_ROW(add_nc), [UOP_SUB] = FIELD_ROW(sub_nc),
+    [UOP_RSUB] = FIELD_ROW(rsub_nc), [UOP_INC] = FIELD_ROW(inc_nc),
+    [UOP_DEC] = FIELD_ROW(dec_nc), [UOP_ADDCON] = FIELD_ROW(addcon_nc),
+    [UOP_SUBCON] = FIELD_ROW(subcon_nc), [UOP_NEG] = FIELD_ROW(neg_nc),
+    [UOP_NOT] = FIELD_ROW(not_nc)
+};
+
+// Handlers of UF_CONST_PTR accesses per module, stores to ROM are ignored by
+// the bus anyway and keep the generic handler
+static const UOP_FUNC load_direct[MEM_ROM + 1][F_COUNT] = {
+    [MEM_IO] = DIRECT_ROW(load_io), [MEM_RAM] = DIRECT_ROW(load_ram),
+    [MEM_ROM] = DIRECT_ROW(load_rom)
+};
+
+static const UOP_FUNC store_direct[MEM_ROM + 1][F_COUNT] = {
+    [MEM_IO] = DIRECT_ROW(store_io), [MEM_RAM] = DIRECT_ROW(store_ram)
+};
+
+// Direct handler of a constant address access, or NULL. Resolving depends on
+// the bus configuration, which is fine as CONFIG, UNCONFIG and RESET flush
+// every prepared block.
+static UOP_FUNC bind_direct(UOP *u) {
+    uint32_t offset;
+    if (!exec_direct || !(u->flags & UF_CONST_PTR) || (u->flags & UF_DEAD))
+        return NULL;
+    int module = memory_resolve(u->imm, field_n[u->field], &offset);
+    if (module < 0)
+        return NULL;
+    UOP_FUNC func = (u->op == UOP_LOAD) ? load_direct[module][u->field] :
+            store_direct[module][u->field];
+    if (func)
+        u->target = offset;
+    return func;
+}
+
+// Most specific handler of a single uop
+static UOP_FUNC get_handler(const UOP *u) {
+    if ((u->flags & UF_NO_CARRY) && field_handlers_nc[u->op][u->field])
+        return field_handlers_nc[u->op][u->field];
+    if (field_handlers[u->op][u->field])
+        return field_handlers[u->op][u->field];
+    if ((u->flags & UF_NO_CARRY) && handlers_nc[u->op])
+        return handlers_nc[u->op];
+    return handlers[u->op];
+}
+
+typedef struct {
+    int count;
+    uint8_t op[3];
+    UOP_FUNC func;
+} FUSE_ENTRY;
+
+#include "fuse_table.h"
+
+// Fused handler for the longest sequence in fuse_table.h starting at uop[0],
+// n is the number of uops available
+static const FUSE_ENTRY *fuse_find(const UOP *uop, int n) {
+    const FUSE_ENTRY *best = NULL;
+    for (const FUSE_ENTRY *f = fuse_table; f->count; f++) {
+        if ((f->count > n) || (best && (best->count >= f->count)))
+            continue;
+        int i;
+        for (i = 0; i < f->count; i++)
+            if (uop[i].op != f->op[i])
+                break;
+        if (i == f->count)
+            best = f;
+    }
+    return best;
+}
+
+// Rough cycle count: nibbles fetched plus nibbles processed
+static int uop_cycles(const UOP *u) {
+    if (u->op == UOP_LOOP)
+        return 0; // Not an instruction, the loop body is counted instead
+    int cycles = u->length + 2;
+    if (u->op <= UOP_STORE)
+        cycles += (u->field == F_WP) ? 8 : field_n[u->field];
+    return cycles;
+}
+
+// Build the dispatch list of a translated block
+void exec_prepare(BLOCK *block) {
+    EXEC_SLOT *slot = block->slot;
+    block->cycles = 0;
+    block->insns = 0;
+    for (int i = 0; i < block->count; i++) {
+        block->cycles += uop_cycles(&block->uop[i]);
+        block->insns += (block->uop[i].op != UOP_LOOP);
+    }
+    if (block->count && (block->uop[0].op == UOP_LOOP))
+        block->uop[0].imm = block->cycles;
+    UOP_FUNC direct[BLOCK_MAX_UOPS];
+    for (int i = 0; i < block->count; i++)
+        direct[i] = bind_direct(&block->uop[i]);
+
+    for (int i = 0; i < block->count;) {
+        const UOP *u = &block->uop[i];
+        if (u->flags & UF_DEAD) {
+            i++;
+            continue;
+        }
+        // Only consecutive live uops without a direct handler can be fused
+        int n = 0;
+        while ((i + n < block->count) && !(u[n].flags & UF_DEAD) &&
+                !direct[i + n])
+            n++;
+        const FUSE_ENTRY *f = exec_fusion ? fuse_find(u, n) : NULL;
+        if (f) {
+            slot->func = f->func;
+            i += f->count;
+        }
+        else {
+            slot->func = direct[i] ? direct[i] : get_handler(u);
+            i++;
+        }
+        slot->uop = u;
+        slot++;
+    }
+    slot->func = NULL;
+}
+
+void exec_block(const BLOCK *block) {
+    for (const EXEC_SLOT *slot = block->slot; slot->func; slot++) {
+        if (slot->func(slot->uop))
+            return;
+    }
+    cpu.pc = block->end;
+}
@@ -0,0 +1,585 @@
+// Generated by tools/gen_fuse.py from fuse_profile.txt, do not edit
+
+static int fuse_add_goc(const UOP *u) {
+    op_add(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_add_gonc(const UOP *u) {
+    op_add(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_add_rtnc(const UOP *u) {
+    op_add(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_add_rtnnc(const UOP *u) {
+    op_add(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_sub_goc(const UOP *u) {
+    op_sub(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_sub_gonc(const UOP *u) {
+    op_sub(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_sub_rtnc(const UOP *u) {
+    op_sub(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_sub_rtnnc(const UOP *u) {
+    op_sub(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_rsub_goc(const UOP *u) {
+    op_rsub(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_rsub_gonc(const UOP *u) {
+    op_rsub(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_rsub_rtnc(const UOP *u) {
+    op_rsub(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_rsub_rtnnc(const UOP *u) {
+    op_rsub(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_inc_goc(const UOP *u) {
+    op_inc(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_inc_gonc(const UOP *u) {
+    op_inc(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_inc_rtnc(const UOP *u) {
+    op_inc(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_inc_rtnnc(const UOP *u) {
+    op_inc(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_dec_goc(const UOP *u) {
+    op_dec(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_dec_gonc(const UOP *u) {
+    op_dec(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_dec_rtnc(const UOP *u) {
+    op_dec(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_dec_rtnnc(const UOP *u) {
+    op_dec(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_addcon_goc(const UOP *u) {
+    op_addcon(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_addcon_gonc(const UOP *u) {
+    op_addcon(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_addcon_rtnc(const UOP *u) {
+    op_addcon(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_addcon_rtnnc(const UOP *u) {
+    op_addcon(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_subcon_goc(const UOP *u) {
+    op_subcon(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_subcon_gonc(const UOP *u) {
+    op_subcon(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_subcon_rtnc(const UOP *u) {
+    op_subcon(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_subcon_rtnnc(const UOP *u) {
+    op_subcon(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_neg_goc(const UOP *u) {
+    op_neg(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_neg_gonc(const UOP *u) {
+    op_neg(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_neg_rtnc(const UOP *u) {
+    op_neg(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_neg_rtnnc(const UOP *u) {
+    op_neg(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_dadd_goc(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_dadd_gonc(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_dadd_rtnc(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_dadd_rtnnc(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_dsub_goc(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_dsub_gonc(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_dsub_rtnc(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_dsub_rtnnc(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_pinc_goc(const UOP *u) {
+    op_pinc(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_pinc_gonc(const UOP *u) {
+    op_pinc(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_pinc_rtnc(const UOP *u) {
+    op_pinc(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_pinc_rtnnc(const UOP *u) {
+    op_pinc(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_pdec_goc(const UOP *u) {
+    op_pdec(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_pdec_gonc(const UOP *u) {
+    op_pdec(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_pdec_rtnc(const UOP *u) {
+    op_pdec(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_pdec_rtnnc(const UOP *u) {
+    op_pdec(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_cpp1_goc(const UOP *u) {
+    op_cpp1(&u[0]);
+    return op_goc(&u[1]);
+}
+
+static int fuse_cpp1_gonc(const UOP *u) {
+    op_cpp1(&u[0]);
+    return op_gonc(&u[1]);
+}
+
+static int fuse_cpp1_rtnc(const UOP *u) {
+    op_cpp1(&u[0]);
+    return op_rtnc(&u[1]);
+}
+
+static int fuse_cpp1_rtnnc(const UOP *u) {
+    op_cpp1(&u[0]);
+    return op_rtnnc(&u[1]);
+}
+
+static int fuse_dadd_dec(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_dec(&u[1]);
+}
+
+static int fuse_store_dadd(const UOP *u) {
+    op_store(&u[0]);
+    return op_dadd(&u[1]);
+}
+
+static int fuse_add_dadd(const UOP *u) {
+    op_add(&u[0]);
+    return op_dadd(&u[1]);
+}
+
+static int fuse_load_add(const UOP *u) {
+    op_load(&u[0]);
+    return op_add(&u[1]);
+}
+
+static int fuse_load_store(const UOP *u) {
+    op_load(&u[0]);
+    return op_store(&u[1]);
+}
+
+static int fuse_dadd_tne(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_tne(&u[1]);
+}
+
+static int fuse_load_dadd(const UOP *u) {
+    op_load(&u[0]);
+    return op_dadd(&u[1]);
+}
+
+static int fuse_dadd_dadd(const UOP *u) {
+    op_dadd(&u[0]);
+    return op_dadd(&u[1]);
+}
+
+static int fuse_dset_load(const UOP *u) {
+    op_dset(&u[0]);
+    return op_load(&u[1]);
+}
+
+static int fuse_inc_store(const UOP *u) {
+    op_inc(&u[0]);
+    return op_store(&u[1]);
+}
+
+static int fuse_load_inc(const UOP *u) {
+    op_load(&u[0]);
+    return op_inc(&u[1]);
+}
+
+static int fuse_store_rtn(const UOP *u) {
+    op_store(&u[0]);
+    return op_rtn(&u[1]);
+}
+
+static int fuse_dec_tnz(const UOP *u) {
+    op_dec(&u[0]);
+    return op_tnz(&u[1]);
+}
+
+static int fuse_dsub_dec(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_dec(&u[1]);
+}
+
+static int fuse_dsub_dsub(const UOP *u) {
+    op_dsub(&u[0]);
+    return op_dsub(&u[1]);
+}
+
+static int fuse_store_dsub(const UOP *u) {
+    op_store(&u[0]);
+    return op_dsub(&u[1]);
+}
+
+static int fuse_lhex_copy(const UOP *u) {
+    op_lhex(&u[0]);
+    return op_copy(&u[1]);
+}
+
+static int fuse_dset_lhex(const UOP *u) {
+    op_dset(&u[0]);
+    return op_lhex(&u[1]);
+}
+
+static int fuse_copy_load(const UOP *u) {
+    op_copy(&u[0]);
+    return op_load(&u[1]);
+}
+
+static int fuse_dset_dset(const UOP *u) {
+    op_dset(&u[0]);
+    return op_dset(&u[1]);
+}
+
+static int fuse_copy_store(const UOP *u) {
+    op_copy(&u[0]);
+    return op_store(&u[1]);
+}
+
+static int fuse_lhex_dset(const UOP *u) {
+    op_lhex(&u[0]);
+    return op_dset(&u[1]);
+}
+
+static int fuse_zero_dset(const UOP *u) {
+    op_zero(&u[0]);
+    return op_dset(&u[1]);
+}
+
+static int fuse_copy_gosub(const UOP *u) {
+    op_copy(&u[0]);
+    return op_gosub(&u[1]);
+}
+
+static int fuse_dset_store(const UOP *u) {
+    op_dset(&u[0]);
+    return op_store(&u[1]);
+}
+
+static int fuse_store_lhex(const UOP *u) {
+    op_store(&u[0]);
+    return op_lhex(&u[1]);
+}
+
+static int fuse_dadd_dec_gonc(const UOP *u) {
+    op_dadd(&u[0]);
+    op_dec(&u[1]);
+    return op_gonc(&u[2]);
+}
+
+static int fuse_add_dadd_dec(const UOP *u) {
+    op_add(&u[0]);
+    op_dadd(&u[1]);
+    return op_dec(&u[2]);
+}
+
+static int fuse_load_add_dadd(const UOP *u) {
+    op_load(&u[0]);
+    op_add(&u[1]);
+    return op_dadd(&u[2]);
+}
+
+static int fuse_load_dadd_tne(const UOP *u) {
+    op_load(&u[0]);
+    op_dadd(&u[1]);
+    return op_tne(&u[2]);
+}
+
+static int fuse_dadd_dadd_dec(const UOP *u) {
+    op_dadd(&u[0]);
+    op_dadd(&u[1]);
+    return op_dec(&u[2]);
+}
+
+static int fuse_load_store_dadd(const UOP *u) {
+    op_load(&u[0]);
+    op_store(&u[1]);
+    return op_dadd(&u[2]);
+}
+
+static int fuse_store_dadd_dadd(const UOP *u) {
+    op_store(&u[0]);
+    op_dadd(&u[1]);
+    return op_dadd(&u[2]);
+}
+
+static int fuse_store_dadd_dec(const UOP *u) {
+    op_store(&u[0]);
+    op_dadd(&u[1]);
+    return op_dec(&u[2]);
+}
+
+static int fuse_dset_load_inc(const UOP *u) {
+    op_dset(&u[0]);
+    op_load(&u[1]);
+    return op_inc(&u[2]);
+}
+
+static int fuse_inc_store_rtn(const UOP *u) {
+    op_inc(&u[0]);
+    op_store(&u[1]);
+    return op_rtn(&u[2]);
+}
+
+static int fuse_load_inc_store(const UOP *u) {
+    op_load(&u[0]);
+    op_inc(&u[1]);
+    return op_store(&u[2]);
+}
+
+static int fuse_dadd_dec_tnz(const UOP *u) {
+    op_dadd(&u[0]);
+    op_dec(&u[1]);
+    return op_tnz(&u[2]);
+}
+
+static int fuse_dsub_dec_gonc(const UOP *u) {
+    op_dsub(&u[0]);
+    op_dec(&u[1]);
+    return op_gonc(&u[2]);
+}
+
+static int fuse_dsub_dsub_dec(const UOP *u) {
+    op_dsub(&u[0]);
+    op_dsub(&u[1]);
+    return op_dec(&u[2]);
+}
+
+static int fuse_load_store_dsub(const UOP *u) {
+    op_load(&u[0]);
+    op_store(&u[1]);
+    return op_dsub(&u[2]);
+}
+
+static int fuse_store_dsub_dsub(const UOP *u) {
+    op_store(&u[0]);
+    op_dsub(&u[1]);
+    return op_dsub(&u[2]);
+}
+
+static const FUSE_ENTRY fuse_table[] = {
+    {2, {UOP_ADD, UOP_GOC}, fuse_add_goc},
+    {2, {UOP_ADD, UOP_GONC}, fuse_add_gonc},
+    {2, {UOP_ADD, UOP_RTNC}, fuse_add_rtnc},
+    {2, {UOP_ADD, UOP_RTNNC}, fuse_add_rtnnc},
+    {2, {UOP_SUB, UOP_GOC}, fuse_sub_goc},
+    {2, {UOP_SUB, UOP_GONC}, fuse_sub_gonc},
+    {2, {UOP_SUB, UOP_RTNC}, fuse_sub_rtnc},
+    {2, {UOP_SUB, UOP_RTNNC}, fuse_sub_rtnnc},
+    {2, {UOP_RSUB, UOP_GOC}, fuse_rsub_goc},
+    {2, {UOP_RSUB, UOP_GONC}, fuse_rsub_gonc},
+    {2, {UOP_RSUB, UOP_RTNC}, fuse_rsub_rtnc},
+    {2, {UOP_RSUB, UOP_RTNNC}, fuse_rsub_rtnnc},
+    {2, {UOP_INC, UOP_GOC}, fuse_inc_goc},
+    {2, {UOP_INC, UOP_GONC}, fuse_inc_gonc},
+    {2, {UOP_INC, UOP_RTNC}, fuse_inc_rtnc},
+    {2, {UOP_INC, UOP_RTNNC}, fuse_inc_rtnnc},
+    {2, {UOP_DEC, UOP_GOC}, fuse_dec_goc},
+    {2, {UOP_DEC, UOP_GONC}, fuse_dec_gonc},
+    {2, {UOP_DEC, UOP_RTNC}, fuse_dec_rtnc},
+    {2, {UOP_DEC, UOP_RTNNC}, fuse_dec_rtnnc},
+    {2, {UOP_ADDCON, UOP_GOC}, fuse_addcon_goc},
+    {2, {UOP_ADDCON, UOP_GONC}, fuse_addcon_gonc},
+    {2, {UOP_ADDCON, UOP_RTNC}, fuse_addcon_rtnc},
+    {2, {UOP_ADDCON, UOP_RTNNC}, fuse_addcon_rtnnc},
+    {2, {UOP_SUBCON, UOP_GOC}, fuse_subcon_goc},
+    {2, {UOP_SUBCON, UOP_GONC}, fuse_subcon_gonc},
+    {2, {UOP_SUBCON, UOP_RTNC}, fuse_subcon_rtnc},
+    {2, {UOP_SUBCON, UOP_RTNNC}, fuse_subcon_rtnnc},
+    {2, {UOP_NEG, UOP_GOC}, fuse_neg_goc},
+    {2, {UOP_NEG, UOP_GONC}, fuse_neg_gonc},
+    {2, {UOP_NEG, UOP_RTNC}, fuse_neg_rtnc},
+    {2, {UOP_NEG, UOP_RTNNC}, fuse_neg_rtnnc},
+    {2, {UOP_DADD, UOP_GOC}, fuse_dadd_goc},
+    {2, {UOP_DADD, UOP_GONC}, fuse_dadd_gonc},
+    {2, {UOP_DADD, UOP_RTNC}, fuse_dadd_rtnc},
+    {2, {UOP_DADD, UOP_RTNNC}, fuse_dadd_rtnnc},
+    {2, {UOP_DSUB, UOP_GOC}, fuse_dsub_goc},
+    {2, {UOP_DSUB, UOP_GONC}, fuse_dsub_gonc},
+    {2, {UOP_DSUB, UOP_RTNC}, fuse_dsub_rtnc},
+    {2, {UOP_DSUB, UOP_RTNNC}, fuse_dsub_rtnnc},
+    {2, {UOP_PINC, UOP_GOC}, fuse_pinc_goc},
+    {2, {UOP_PINC, UOP_GONC}, fuse_pinc_gonc},
+    {2, {UOP_PINC, UOP_RTNC}, fuse_pinc_rtnc},
+    {2, {UOP_PINC, UOP_RTNNC}, fuse_pinc_rtnnc},
+    {2, {UOP_PDEC, UOP_GOC}, fuse_pdec_goc},
+    {2, {UOP_PDEC, UOP_GONC}, fuse_pdec_gonc},
+    {2, {UOP_PDEC, UOP_RTNC}, fuse_pdec_rtnc},
+    {2, {UOP_PDEC, UOP_RTNNC}, fuse_pdec_rtnnc},
+    {2, {UOP_CPP1, UOP_GOC}, fuse_cpp1_goc},
+    {2, {UOP_CPP1, UOP_GONC}, fuse_cpp1_gonc},
+    {2, {UOP_CPP1, UOP_RTNC}, fuse_cpp1_rtnc},
+    {2, {UOP_CPP1, UOP_RTNNC}, fuse_cpp1_rtnnc},
+    {2, {UOP_DADD, UOP_DEC}, fuse_dadd_dec},
+    {2, {UOP_STORE, UOP_DADD}, fuse_store_dadd},
+    {2, {UOP_ADD, UOP_DADD}, fuse_add_dadd},
+    {2, {UOP_LOAD, UOP_ADD}, fuse_load_add},
+    {2, {UOP_LOAD, UOP_STORE}, fuse_load_store},
+    {2, {UOP_DADD, UOP_TNE}, fuse_dadd_tne},
+    {2, {UOP_LOAD, UOP_DADD}, fuse_load_dadd},
+    {2, {UOP_DADD, UOP_DADD}, fuse_dadd_dadd},
+    {2, {UOP_DSET, UOP_LOAD}, fuse_dset_load},
+    {2, {UOP_INC, UOP_STORE}, fuse_inc_store},
+    {2, {UOP_LOAD, UOP_INC}, fuse_load_inc},
+    {2, {UOP_STORE, UOP_RTN}, fuse_store_rtn},
+    {2, {UOP_DEC, UOP_TNZ}, fuse_dec_tnz},
+    {2, {UOP_DSUB, UOP_DEC}, fuse_dsub_dec},
+    {2, {UOP_DSUB, UOP_DSUB}, fuse_dsub_dsub},
+    {2, {UOP_STORE, UOP_DSUB}, fuse_store_dsub},
+    {2, {UOP_LHEX, UOP_COPY}, fuse_lhex_copy},
+    {2, {UOP_DSET, UOP_LHEX}, fuse_dset_lhex},
+    {2, {UOP_COPY, UOP_LOAD}, fuse_copy_load},
+    {2, {UOP_DSET, UOP_DSET}, fuse_dset_dset},
+    {2, {UOP_COPY, UOP_STORE}, fuse_copy_store},
+    {2, {UOP_LHEX, UOP_DSET}, fuse_lhex_dset},
+    {2, {UOP_ZERO, UOP_DSET}, fuse_zero_dset},
+    {2, {UOP_COPY, UOP_GOSUB}, fuse_copy_gosub},
+    {2, {UOP_DSET, UOP_STORE}, fuse_dset_store},
+    {2, {UOP_STORE, UOP_LHEX}, fuse_store_lhex},
+    {3, {UOP_DADD, UOP_DEC, UOP_GONC}, fuse_dadd_dec_gonc},
+    {3, {UOP_ADD, UOP_DADD, UOP_DEC}, fuse_add_dadd_dec},
+    {3, {UOP_LOAD, UOP_ADD, UOP_DADD}, fuse_load_add_dadd},
+    {3, {UOP_LOAD, UOP_DADD, UOP_TNE}, fuse_load_dadd_tne},
+    {3, {UOP_DADD, UOP_DADD, UOP_DEC}, fuse_dadd_dadd_dec},
+    {3, {UOP_LOAD, UOP_STORE, UOP_DADD}, fuse_load_store_dadd},
+    {3, {UOP_STORE, UOP_DADD, UOP_DADD}, fuse_store_dadd_dadd},
+    {3, {UOP_STORE, UOP_DADD, UOP_DEC}, fuse_store_dadd_dec},
+    {3, {UOP_DSET, UOP_LOAD, UOP_INC}, fuse_dset_load_inc},
+    {3, {UOP_INC, UOP_STORE, UOP_RTN}, fuse_inc_store_rtn},
+    {3, {UOP_LOAD, UOP_INC, UOP_STORE}, fuse_load_inc_store},
+    {3, {UOP_DADD, UOP_DEC, UOP_TNZ}, fuse_dadd_dec_tnz},
+    {3, {UOP_DSUB, UOP_DEC, UOP_GONC}, fuse_dsub_dec_gonc},
+    {3, {UOP_DSUB, UOP_DSUB, UOP_DEC}, fuse_dsub_dsub_dec},
+    {3, {UOP_LOAD, UOP_STORE, UOP_DSUB}, fuse_load_store_dsub},
+    {3, {UOP_STORE, UOP_DSUB, UOP_DSUB}, fuse_store_dsub_dsub},
+    {0, {0}, NULL}
+};
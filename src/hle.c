@@ -0,0 +1,357 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "cpu.h"
+#include "hle.h"
+
+// High level emulation of ROM routines. A hook attaches a native C routine
+// to the entry address of a ROM routine for one ROM version. Hooks are read
+// from a text file with lines of "<ROM hash> <address> <native name>", hash
+// and address in hex, lines for other ROM versions are skipped.
+//
+// A hook runs when a block starts at its address while the address maps to
+// ROM, so it catches GOSUB, GOSBVL and jumps to the entry. The native routine
+// applies the effects of the ROM routine and returns like RTN. Code falling
+// through into the entry from inside a block runs the original.
+//
+// Natives implement the contract documented with them, which has to match
+// the ROM routine they replace. With hle_verify set, every call runs the
+// native, undoes its effects, runs the original until it returns and
+// compares CPU state and memory writes. A hook that differs is disabled,
+// execution always continues with the result of the original.
+
+#define MAX_HOOKS       (256)
+#define LOG_SIZE        (65536)
+#define VERIFY_CYCLES   (100000000) // Limit for the original to return
+
+// Native routine, returns a rough cycle count
+typedef int (*HLE_FUNC)();
+
+typedef struct {
+    const char *name;
+    HLE_FUNC func;
+} HLE_NATIVE;
+
+typedef struct {
+    uint32_t address;
+    const HLE_NATIVE *native;
+    bool enabled;
+    uint64_t calls;
+    uint64_t verified;
+    uint64_t failed;
+} HLE_HOOK;
+
+bool hle_active;
+bool hle_verify;
+
+static HLE_HOOK hooks[MAX_HOOKS];
+static int hook_count;
+static uint8_t hook_bits[(ADDR_MASK + 1) / 8];
+static bool verifying;
+
+// Natives. Counts are taken from C(A), the usual length argument.
+
+static uint32_t get_count() {
+    return cpu.reg[R_C] & ADDR_MASK;
+}
+
+static void clear_count() {
+    cpu.reg[R_C] &= ~(uint64_t)ADDR_MASK;
+}
+
+// Copy C(A) nibbles from (D0) to (D1), lowest address first. Leaves D0 and
+// D1 after the blocks and C(A) cleared.
+static int native_copy_up() {
+    uint32_t n = get_count();
+    for (uint32_t i = 0; i < n; i++)
+        memory_write_nibble(cpu.d[1] + i, memory_read_nibble(cpu.d[0] + i));
+    cpu.d[0] = (cpu.d[0] + n) & ADDR_MASK;
+    cpu.d[1] = (cpu.d[1] + n) & ADDR_MASK;
+    clear_count();
+    return 32 + n;
+}
+
+// Copy C(A) nibbles ending before D0 to the area ending before D1, highest
+// address first. Leaves D0 and D1 at the start of the blocks and C(A)
+// cleared.
+static int native_copy_down() {
+    uint32_t n = get_count();
+    for (uint32_t i = 1; i <= n; i++)
+        memory_write_nibble(cpu.d[1] - i, memory_read_nibble(cpu.d[0] - i));
+    cpu.d[0] = (cpu.d[0] - n) & ADDR_MASK;
+    cpu.d[1] = (cpu.d[1] - n) & ADDR_MASK;
+    clear_count();
+    return 32 + n;
+}
+
+// Clear C(A) nibbles from (D1). Leaves D1 after the block and C(A) cleared.
+static int native_clear() {
+    uint32_t n = get_count();
+    for (uint32_t i = 0; i < n; i++)
+        memory_write_nibble(cpu.d[1] + i, 0);
+    cpu.d[1] = (cpu.d[1] + n) & ADDR_MASK;
+    clear_count();
+    return 32 + n / 2;
+}
+
+static const HLE_NATIVE natives[] = {
+    { "copy_up", native_copy_up },
+    { "copy_down", native_copy_down },
+    { "clear", native_clear },
+    { NULL, NULL }
+};
+
+// Read the hooks for the current ROM from fn, returns the number of hooks
+// added or -1 if the file can not be read
+int hle_load(const char *fn) {
+    FILE *fp = fopen(fn, "r");
+    if (!fp)
+        return -1;
+    uint64_t hash = rom_hash();
+    char line[256];
+    int added = 0;
+    for (int n = 1; fgets(line, sizeof(line), fp); n++) {
+        unsigned long long line_hash;
+        unsigned int address;
+        char name[64];
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if (sscanf(line, "%llx %x %63s", &line_hash, &address, name) != 3) {
+            fprintf(stderr, "%s:%d: invalid hook\n", fn, n);
+            continue;
+        }
+        if ((line_hash != hash) || (address > ADDR_MASK))
+            continue;
+        const HLE_NATIVE *native = natives;
+        while (native->name && strcmp(native->name, name))
+            native++;
+        if (!native->name) {
+            fprintf(stderr, "%s:%d: unknown native %s\n", fn, n, name);
+            continue;
+        }
+        if (hook_count == MAX_HOOKS)
+            fatal("Too many HLE hooks\n");
+        HLE_HOOK *hook = &hooks[hook_count++];
+        memset(hook, 0, sizeof(HLE_HOOK));
+        hook->address = address;
+        hook->native = native;
+        hook->enabled = true;
+        hook_bits[address >> 3] |= 1 << (address & 7);
+        hle_active = true;
+        added++;
+    }
+    fclose(fp);
+    return added;
+}
+
+// Switch all hooks using the named native on or off
+bool hle_set(const char *name, bool enable) {
+    bool found = false;
+    for (int i = 0; i < hook_count; i++) {
+        if (!strcmp(hooks[i].native->name, name)) {
+            hooks[i].enabled = enable;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void add_diff(char *diff, size_t size, const char *name) {
+    size_t len = strlen(diff);
+    snprintf(diff + len, size - len, " %s", name);
+}
+
+// Compare the architectural state left by the native and the original
+static void compare_cpu(const CPU_STATE *a, const CPU_STATE *b, char *diff,
+        size_t size) {
+    static const char *reg_names[] = { "A", "B", "C", "D" };
+    static const char *r_names[] = { "R0", "R1", "R2", "R3", "R4" };
+    for (int i = 0; i < 4; i++)
+        if (a->reg[i] != b->reg[i])
+            add_diff(diff, size, reg_names[i]);
+    for (int i = 0; i < 5; i++)
+        if (a->r[i] != b->r[i])
+            add_diff(diff, size, r_names[i]);
+    if (a->d[0] != b->d[0])
+        add_diff(diff, size, "D0");
+    if (a->d[1] != b->d[1])
+        add_diff(diff, size, "D1");
+    if (a->pc != b->pc)
+        add_diff(diff, size, "PC");
+    if (a->p != b->p)
+        add_diff(diff, size, "P");
+    if (a->st != b->st)
+        add_diff(diff, size, "ST");
+    if (a->hst != b->hst)
+        add_diff(diff, size, "HST");
+    if (a->carry != b->carry)
+        add_diff(diff, size, "carry");
+    if (a->dec != b->dec)
+        add_diff(diff, size, "mode");
+    if ((a->rstk_count != b->rstk_count) || memcmp(a->rstk, b->rstk,
+            a->rstk_count * sizeof(uint32_t)))
+        add_diff(diff, size, "RSTK");
+    if (a->out != b->out)
+        add_diff(diff, size, "OUT");
+    if (a->int_enable != b->int_enable)
+        add_diff(diff, size, "interrupts");
+}
+
+// Compare memory written by either side. The native writes have been undone
+// and the original ran afterwards, so memory now holds the original result.
+static bool compare_memory(const MEM_LOG *native_log, int native_count,
+        const MEM_LOG *rom_log, int rom_count) {
+    // Value expected from the native, bit 4 set when known
+    static uint8_t expect[ADDR_MASK + 1];
+    bool same = true;
+    for (int i = 0; i < rom_count; i++)
+        if (!expect[rom_log[i].address])
+            expect[rom_log[i].address] = 0x10 | rom_log[i].old_value;
+    for (int i = 0; i < native_count; i++)
+        expect[native_log[i].address] = 0x10 | native_log[i].new_value;
+    for (int i = 0; i < native_count; i++) {
+        uint32_t address = native_log[i].address;
+        if (expect[address] &&
+                ((expect[address] & 0xf) != memory_read_nibble(address)))
+            same = false;
+    }
+    for (int i = 0; i < rom_count; i++) {
+        uint32_t address = rom_log[i].address;
+        if (expect[address] &&
+                ((expect[address] & 0xf) != memory_read_nibble(address)))
+            same = false;
+    }
+    for (int i = 0; i < native_count; i++)
+        expect[native_log[i].address] = 0;
+    for (int i = 0; i < rom_count; i++)
+        expect[rom_log[i].address] = 0;
+    return same;
+}
+
+static void verify(HLE_HOOK *hook) {
+    static MEM_LOG native_log[LOG_SIZE];
+    static MEM_LOG rom_log[LOG_SIZE];
+    CPU_STATE entry = cpu;
+    char diff[256] = "";
+
+    if (!entry.rstk_count) {
+        // The original's return can not be told from an empty stack pop,
+        // keep the native result unverified
+        cpu.cycles += hook->native->func();
+        cpu.pc = cpu_pop();
+        return;
+    }
+
+    memory_log_start(native_log, LOG_SIZE);
+    hook->native->func();
+    cpu.pc = cpu_pop();
+    int native_count = memory_log_stop();
+    CPU_STATE native = cpu;
+    if (native_count > LOG_SIZE) {
+        // Too many writes to undo, keep the native result
+        fprintf(stderr, "HLE: %s at %05x wrote too much to be verified\n",
+                hook->native->name, hook->address);
+        return;
+    }
+    for (int i = native_count - 1; i >= 0; i--)
+        memory_write_nibble(native_log[i].address, native_log[i].old_value);
+    cpu = entry;
+
+    // Run the original until it returns to the caller
+    int depth = entry.rstk_count;
+    uint32_t ret = entry.rstk[depth - 1];
+    uint64_t end = cpu.cycles + VERIFY_CYCLES;
+    verifying = true;
+    memory_log_start(rom_log, LOG_SIZE);
+    do {
+        cpu_run_block();
+    } while (((cpu.rstk_count != depth - 1) || (cpu.pc != ret)) &&
+            (cpu.cycles < end));
+    int rom_count = memory_log_stop();
+    verifying = false;
+
+    if (cpu.cycles >= end)
+        add_diff(diff, sizeof(diff), "no return");
+    else if (rom_count > LOG_SIZE)
+        add_diff(diff, sizeof(diff), "too many writes");
+    else if (!compare_memory(native_log, native_count, rom_log, rom_count))
+        add_diff(diff, sizeof(diff), "memory");
+    compare_cpu(&native, &cpu, diff, sizeof(diff));
+
+    if (diff[0]) {
+        fprintf(stderr, "HLE: %s at %05x differs from ROM:%s, disabled\n",
+                hook->native->name, hook->address, diff);
+        hook->failed++;
+        hook->enabled = false;
+    }
+    else {
+        hook->verified++;
+    }
+}
+
+// Called at every block entry when hooks are loaded, runs the hook at PC if
+// there is one. Returns true if it did, with PC at the return address.
+bool hle_enter() {
+    uint32_t pc = cpu.pc;
+    if (!(hook_bits[pc >> 3] & (1 << (pc & 7))) || verifying)
+        return false;
+    HLE_HOOK *hook = NULL;
+    for (int i = 0; i < hook_count; i++) {
+        if (hooks[i].enabled && (hooks[i].address == pc)) {
+            hook = &hooks[i];
+            break;
+        }
+    }
+    if (!hook || (memory_map(pc) != MEM_ROM))
+        return false;
+
+    hook->calls++;
+    if (hle_verify) {
+        verify(hook);
+        return true;
+    }
+    cpu.cycles += hook->native->func();
+    cpu.pc = cpu_pop();
+    return true;
+}
+
+void hle_report() {
+    for (int i = 0; i < hook_count; i++) {
+        HLE_HOOK *hook = &hooks[i];
+        printf("HLE %-10s %05x: %llu calls, %llu verified, %llu failed%s\n",
+                hook->native->name, hook->address,
+                (unsigned long long)hook->calls,
+                (unsigned long long)hook->verified,
+                (unsigned long long)hook->failed,
+                hook->enabled ? "" : ", disabled");
+    }
+}
@@ -0,0 +1,372 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "disasm.h"
+#include "memory.h"
+#include "translate.h"
+#include "cpu.h"
+#include "idiom.h"
+
+// Loop idioms. A block that branches back to its own start and only moves
+// memory through D0 / D1 is one of:
+//
+//   copy:  A=DAT0 f, DAT1=A f, D0=D0+n, D1=D1+n, counter, GONC / ?c#0
+//   fill:  DAT1=A f, D1=D1+n, counter, GONC / ?c#0
+//   scan:  A=DAT0 f, D0=D0+n, ?A#C f GOYES (any register test on A)
+//
+// in any order where each access comes before the update of its pointer and
+// the counter (B=B-1 or B=B-CON, any register and fixed field) is the last
+// uop setting carry before GONC. Such blocks get a UOP_LOOP in front that
+// works out the number of iterations, does all the accesses in one go and
+// sets the registers as the last iteration would have left them. Whenever
+// that is not possible, for example when the loop would touch MMIO, the
+// handler returns 0 and the loop body runs as usual.
+//
+// One dispatch runs at most CHUNK_CYCLES worth of iterations. A longer loop
+// is left at its head as the interpreter would leave it, and the next
+// dispatch of the block carries on, so cycle limits, interrupts and
+// scheduled checkpoints or samples are seen in time.
+
+typedef enum {
+    IDIOM_COPY,
+    IDIOM_FILL,
+    IDIOM_SCAN
+} IDIOM_KIND;
+
+typedef struct {
+    IDIOM_KIND kind;
+    const UOP *load;
+    const UOP *store;
+    const UOP *step[2];     // Pointer update of D0 and D1
+    const UOP *counter;
+    const UOP *exit;        // Branch back to the loop start
+} LOOP;
+
+#define MAX_ITERATIONS  (ADDR_MASK + 1)
+#define CHUNK_CYCLES    (4096)
+
+// Recognize loop idioms in new blocks
+bool idiom_enable = true;
+
+// First nibble and length of fields not depending on P
+static bool fixed_field(int field, int *lo, int *n) {
+    static const uint8_t field_lo[] = { 0, 0, 2, 0, 15, 3, 0, 0, 0 };
+    static const uint8_t field_n[] = { 0, 0, 1, 3, 1, 12, 2, 16, 5 };
+    if ((field == F_P) || (field == F_WP))
+        return false;
+    if (field > F_A) {
+        *lo = 0;
+        *n = field - F_A;
+    }
+    else {
+        *lo = field_lo[field];
+        *n = field_n[field];
+    }
+    return true;
+}
+
+static bool is_test(int op) {
+    return (op >= UOP_TEQ) && (op <= UOP_TLE);
+}
+
+static bool match(const UOP *body, int count, uint32_t head, LOOP *loop) {
+    int lo = 0, n = 0;
+    memset(loop, 0, sizeof(LOOP));
+    if (count < 2)
+        return false;
+    loop->exit = &body[count - 1];
+    if ((loop->exit->target != head) || (loop->exit->flags & UF_RTNYES))
+        return false;
+
+    for (int i = 0; i < count - 1; i++) {
+        const UOP *u = &body[i];
+        switch (u->op) {
+        case UOP_LOAD:
+            if (loop->load || loop->step[u->src] ||
+                    !fixed_field(u->field, &lo, &n))
+                return false;
+            loop->load = u;
+            break;
+        case UOP_STORE:
+            if (loop->store || loop->step[u->dst] ||
+                    !fixed_field(u->field, &lo, &n))
+                return false;
+            loop->store = u;
+            break;
+        case UOP_DADD:
+        case UOP_DSUB:
+            // Carry from a pointer update must not reach GONC
+            if (loop->step[u->dst] || loop->counter)
+                return false;
+            loop->step[u->dst] = u;
+            break;
+        case UOP_DEC:
+        case UOP_SUBCON:
+            if (loop->counter || !fixed_field(u->field, &lo, &n))
+                return false;
+            loop->counter = u;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    const UOP *load = loop->load;
+    const UOP *store = loop->store;
+    const UOP *counter = loop->counter;
+    const UOP *exit = loop->exit;
+    if (load && store) {
+        // The stored value is the one just loaded
+        if ((store < load) || (store->src != load->dst) ||
+                (store->field != load->field) || (store->dst == load->src))
+            return false;
+        loop->kind = IDIOM_COPY;
+    }
+    else if (store) {
+        loop->kind = IDIOM_FILL;
+    }
+    else if (load) {
+        loop->kind = IDIOM_SCAN;
+    }
+    else {
+        return false;
+    }
+
+    // Fill and scan runs only move the pointer they access through
+    if ((loop->kind == IDIOM_FILL) && loop->step[1 - store->dst])
+        return false;
+    if ((loop->kind == IDIOM_SCAN) && loop->step[1 - load->src])
+        return false;
+
+    if (loop->kind == IDIOM_SCAN) {
+        // Loop while a test on the loaded register holds
+        return !counter && is_test(exit->op) && (exit->dst == load->dst) &&
+                ((exit->src != load->dst) || (exit->op == UOP_TZ) ||
+                (exit->op == UOP_TNZ)) && fixed_field(exit->field, &lo, &n);
+    }
+
+    // Copy and fill loops count down, the counter must not be the data
+    if (!counter || (counter->dst == (load ? load->dst : store->src)))
+        return false;
+    if (exit->op == UOP_GONC)
+        return true;
+    return (exit->op == UOP_TNZ) && (counter->op == UOP_DEC) &&
+            (exit->dst == counter->dst) && (exit->field == counter->field);
+}
+
+// Add a UOP_LOOP in front of blocks matching a loop idiom
+void idiom_block(BLOCK *block) {
+    LOOP loop;
+    if (!idiom_enable || (block->count >= BLOCK_MAX_UOPS) ||
+            !match(block->uop, block->count, block->pc, &loop))
+        return;
+    memmove(&block->uop[1], &block->uop[0], block->count * sizeof(UOP));
+    memset(&block->uop[0], 0, sizeof(UOP));
+    block->uop[0].op = UOP_LOOP;
+    block->uop[0].src = block->count;
+    block->uop[0].pc = block->pc;
+    block->uop[0].target = block->pc;
+    block->count++;
+}
+
+static uint64_t nib_mask(int n) {
+    return (n >= 16) ? ~(uint64_t)0 : (((uint64_t)1 << (n * 4)) - 1);
+}
+
+static uint64_t get_bits(uint64_t v, int lo, int n) {
+    return (v >> (lo * 4)) & nib_mask(n);
+}
+
+static uint64_t set_bits(uint64_t v, uint64_t x, int lo, int n) {
+    uint64_t m = nib_mask(n) << (lo * 4);
+    return (v & ~m) | ((x << (lo * 4)) & m);
+}
+
+// Pointer increment per iteration
+static int32_t get_step(const UOP *u) {
+    if (!u)
+        return 0;
+    return (u->op == UOP_DADD) ? (int32_t)u->imm : -(int32_t)u->imm;
+}
+
+// Whether any of count accesses of n nibbles from address, step apart, maps
+// to MMIO, by checking the whole span covered by the accesses
+static bool touches_io(uint32_t address, int32_t step, uint64_t count,
+        int n) {
+    uint32_t base;
+    if (!memory_io_base(&base))
+        return false;
+    uint32_t start = address;
+    uint64_t span = (count - 1) * (uint64_t)(step < 0 ? -step : step) + n;
+    if (step < 0)
+        start = (address + (int64_t)(count - 1) * step) & ADDR_MASK;
+    if (span > ADDR_MASK)
+        return true;
+    // The two ranges overlap if either one starts inside the other
+    return (((base - start) & ADDR_MASK) < span) ||
+            (((start - base) & ADDR_MASK) < IO_SIZE);
+}
+
+static bool test(int op, uint64_t x, uint64_t y) {
+    switch (op) {
+    case UOP_TEQ: return x == y;
+    case UOP_TNE: return x != y;
+    case UOP_TZ: return x == 0;
+    case UOP_TNZ: return x != 0;
+    case UOP_TGT: return x > y;
+    case UOP_TLT: return x < y;
+    case UOP_TGE: return x >= y;
+    default: return x <= y;
+    }
+}
+
+// Search until the exit test fails or for limit iterations, returns the
+// number of iterations run
+static uint64_t run_scan(const LOOP *loop, uint64_t limit) {
+    const UOP *load = loop->load;
+    const UOP *exit = loop->exit;
+    int lo = 0, n = 0, tlo = 0, tn = 0;
+    fixed_field(load->field, &lo, &n);
+    fixed_field(exit->field, &tlo, &tn);
+    int32_t step = get_step(loop->step[load->src]);
+    uint32_t p = cpu.d[load->src];
+    uint64_t r = cpu.reg[load->dst];
+    uint64_t y = get_bits(cpu.reg[exit->src], tlo, tn);
+    uint64_t i = 0;
+    bool cond = true;
+    while (cond && (i < limit)) {
+        if (touches_io(p, 0, 1, n))
+            break;
+        r = set_bits(r, memory_read(p, n), lo, n);
+        p = (p + step) & ADDR_MASK;
+        cond = test(exit->op, get_bits(r, tlo, tn), y);
+        i++;
+    }
+    if (!i)
+        return 0;
+    cpu.reg[load->dst] = r;
+    cpu.d[load->src] = p;
+    cpu.carry = cond;
+    cpu.pc = cond ? exit->target : (exit->pc + exit->length) & ADDR_MASK;
+    return i;
+}
+
+// Copy or fill, at most limit iterations. Returns the number of iterations
+// run.
+static uint64_t run_copy(const LOOP *loop, uint64_t limit) {
+    const UOP *load = loop->load;
+    const UOP *store = loop->store;
+    const UOP *counter = loop->counter;
+    int lo = 0, n = 0, clo = 0, cn = 0;
+    fixed_field(store->field, &lo, &n);
+    fixed_field(counter->field, &clo, &cn);
+    if ((counter->op == UOP_DEC) && cpu.dec)
+        return 0;
+
+    // Iterations and final counter
+    uint64_t c = get_bits(cpu.reg[counter->dst], clo, cn);
+    uint64_t k = (counter->op == UOP_DEC) ? 1 : counter->imm;
+    uint64_t count;
+    if (loop->exit->op == UOP_GONC)
+        count = c / k + 1;
+    else
+        count = c ? c : nib_mask(cn) + 1;
+    if (count > MAX_ITERATIONS)
+        return 0;
+    bool done = (count <= limit);
+    if (!done)
+        count = limit;
+    uint64_t c_end = (c - count * k) & nib_mask(cn);
+
+    int32_t dst_step = get_step(loop->step[store->dst]);
+    uint32_t dst = cpu.d[store->dst];
+    if (touches_io(dst, dst_step, count, n))
+        return 0;
+
+    if (loop->kind == IDIOM_COPY) {
+        int32_t src_step = get_step(loop->step[load->src]);
+        uint32_t src = cpu.d[load->src];
+        if (touches_io(src, src_step, count, n))
+            return 0;
+        uint64_t total = count * n;
+        uint64_t v = 0;
+        // A forward contiguous copy is a memmove as long as no element is
+        // read after being overwritten
+        if ((src_step == n) && (dst_step == n) && (total <= ADDR_MASK) &&
+                ((((src - dst) & ADDR_MASK) < total) ||
+                (((dst - src) & ADDR_MASK) >= total))) {
+            v = memory_read(src + (count - 1) * n, n);
+            memory_move(dst, src, total);
+        }
+        else {
+            for (uint64_t i = 0; i < count; i++) {
+                v = memory_read(src, n);
+                memory_write(dst, v, n);
+                src = (src + src_step) & ADDR_MASK;
+                dst = (dst + dst_step) & ADDR_MASK;
+            }
+        }
+        cpu.reg[load->dst] = set_bits(cpu.reg[load->dst], v, lo, n);
+        cpu.d[load->src] = (cpu.d[load->src] + count * src_step) & ADDR_MASK;
+    }
+    else {
+        uint64_t v = get_bits(cpu.reg[store->src], lo, n);
+        for (uint64_t i = 0; i < count; i++) {
+            memory_write(dst, v, n);
+            dst = (dst + dst_step) & ADDR_MASK;
+        }
+    }
+    cpu.d[store->dst] = (cpu.d[store->dst] + count * dst_step) & ADDR_MASK;
+    cpu.reg[counter->dst] = set_bits(cpu.reg[counter->dst], c_end, clo, cn);
+    // GONC leaves on a borrow, ?c#0 on a failed test. Unless done, the last
+    // iteration branched back.
+    bool gonc = (loop->exit->op == UOP_GONC);
+    cpu.carry = done ? gonc : !gonc;
+    cpu.pc = done ? (loop->exit->pc + loop->exit->length) & ADDR_MASK :
+            loop->exit->target;
+    return count;
+}
+
+// UOP_LOOP handler, cycles is the cost of one pass through the block.
+// Returns 1 with the loop done, or 0 to run the body normally.
+int idiom_run(const UOP *uop, int cycles) {
+    LOOP loop;
+    if (!idiom_enable || !match(uop + 1, uop->src, uop->target, &loop))
+        return 0;
+    uint64_t limit = (cycles > 0) ? CHUNK_CYCLES / cycles : MAX_ITERATIONS;
+    if (!limit)
+        limit = 1;
+    uint64_t count = (loop.kind == IDIOM_SCAN) ? run_scan(&loop, limit) :
+            run_copy(&loop, limit);
+    if (!count)
+        return 0;
+    // The block itself is accounted for once by the caller
+    cpu.cycles += (count - 1) * cycles;
+    cpu.insns += (count - 1) * uop->src;
+    return 1;
+}
@@ -0,0 +1,85 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "memory.h"
+#include "cpu.h"
+#include "io.h"
+
+// Memory mapped I/O registers. For now registers only hold the value written.
+// The keyboard is a matrix read with IN: each OUT line drives a column, and
+// pressed keys in driven columns pull their IN line high.
+
+static uint8_t io[IO_SIZE];
+static uint16_t keys[KEY_COLUMNS];
+
+void io_init() {
+    memset(io, 0, IO_SIZE);
+    memset(keys, 0, sizeof(keys));
+}
+
+// Press or release the key between OUT bit out and IN bit in. Pressing a key
+// raises the keyboard interrupt.
+void io_key(int out, int in, bool pressed) {
+    if ((out < 0) || (out >= KEY_COLUMNS) || (in < 0) || (in >= 16))
+        return;
+    if (pressed) {
+        keys[out] |= 1u << in;
+        cpu.int_pending = true;
+    }
+    else {
+        keys[out] &= ~(1u << in);
+    }
+}
+
+// Value read by IN with the given OUT value
+uint16_t io_keyboard(uint16_t out) {
+    uint16_t in = 0;
+    for (int i = 0; i < KEY_COLUMNS; i++)
+        if (out & (1u << i))
+            in |= keys[i];
+    return in;
+}
+
+uint8_t io_read(uint32_t offset) {
+    return io[offset];
+}
+
+void io_write(uint32_t offset, uint8_t value) {
+    io[offset] = value & 0xf;
+}
+
+// Registers and keyboard, for snapshots
+void io_save(IO_STATE *state) {
+    memcpy(state->regs, io, IO_SIZE);
+    memcpy(state->keys, keys, sizeof(keys));
+}
+
+void io_restore(const IO_STATE *state) {
+    memcpy(io, state->regs, IO_SIZE);
+    memcpy(keys, state->keys, sizeof(keys));
+}
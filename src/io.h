@@ -0,0 +1,39 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#define KEY_COLUMNS     (12)
+
+// Saved I/O state, see io_save()
+typedef struct {
+    uint8_t regs[IO_SIZE];
+    uint16_t keys[KEY_COLUMNS]; // Pressed keys, IN bits for each OUT bit
+} IO_STATE;
+
+void io_init();
+uint8_t io_read(uint32_t offset);
+void io_write(uint32_t offset, uint8_t value);
+void io_save(IO_STATE *state);
+void io_restore(const IO_STATE *state);
+void io_key(int out, int in, bool pressed);
+uint16_t io_keyboard(uint16_t out);
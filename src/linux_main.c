@@ -24,37 +24,278 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <assert.h>
+#include <string.h>
+#include <unistd.h>
 #include "config.h"
 #include "util.h"
 #include "rom.h"
+#include "translate.h"
+#include "exec.h"
+#include "tcache.h"
+#include "xref.h"
+#include "trace.h"
+#include "hle.h"
+#include "idiom.h"
+#include "rewind.h"
+#include "bench.h"
+#include "sample.h"
+#include "cpu.h"
 #include "emu.h"
 
-uint8_t *load_file(char *fn) {
-    FILE *fp;
-    fp = fopen(fn, "rb+");
-    if (!fp) {
-        fprintf(stderr, "Error: unable to open file %s\n", fn);
-        exit(1);
+// Print the cross references to and from an address range
+static void xref_query(const char *rom_file, const char *query) {
+    char *end;
+    uint32_t start = strtoul(query, &end, 16) & ADDR_MASK;
+    uint32_t stop = (*end == '-') ? strtoul(end + 1, NULL, 16) & ADDR_MASK :
+            start;
+    if (stop < start)
+        stop = start;
+
+    char fn[1024];
+    snprintf(fn, sizeof(fn), "%s.xref", rom_file);
+    if (!xref_open(fn))
+        fprintf(stderr, "Error: unable to write %s\n", fn);
+
+    const XREF *refs;
+    int count = xref_to(start, stop, &refs);
+    printf("References to %05x-%05x: %d\n", start, stop, count);
+    for (int i = 0; i < count; i++)
+        printf("  %05x %s from %05x\n", refs[i].to,
+                xref_kind_name(refs[i].kind), refs[i].from);
+    count = xref_from(start, stop, &refs);
+    printf("References from %05x-%05x: %d\n", start, stop, count);
+    for (int i = 0; i < count; i++)
+        printf("  %05x %s %05x\n", refs[i].from,
+                xref_kind_name(refs[i].kind), refs[i].to);
+    xref_close();
+}
+
+// Parse a list of register names for trace snapshots
+static uint32_t parse_trace_regs(const char *list) {
+    static const char names[] = "ABCD01P";
+    uint32_t regs = 0;
+    for (const char *c = list; *c; c++) {
+        const char *n = strchr(names, *c);
+        if (!n) {
+            fprintf(stderr, "Error: unknown register %c\n", *c);
+            exit(1);
+        }
+        regs |= 1u << (n - names);
     }
-    fseek(fp, 0, SEEK_END);
-    size_t fsize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    void *mem = malloc(fsize);
-    assert(mem);
-    size_t result = fread(mem, fsize, 1, fp);
-    assert(result == 1);
-    fclose(fp);
-    return (uint8_t *)mem;
+    return regs;
 }
 
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -r <file>    ROM file (default ROM.48G)\n"
+            "  -l <count>   List translated blocks from address 0 and exit\n"
+            "  -c <cycles>  Number of cycles to run (default 100000000)\n"
+            "  -p <file>    Write uop sequence profile after running\n"
+            "  -F           Disable fused handlers\n"
+            "  -L           Disable loop idioms\n"
+            "  -M           Disable direct accesses at constant addresses\n"
+            "  -t <file>    Translation cache file (default <rom>.tcache)\n"
+            "  -T           Disable the translation cache\n"
+            "  -d <file>    Write an execution trace, decoded by trace_dump\n"
+            "  -s <blocks>  Register snapshot interval in the trace (default\n"
+            "               1024, 0 for none)\n"
+            "  -S <regs>    Registers in snapshots, from ABCD01P (default all)\n"
+            "  -H <file>    HLE hooks file (default <rom>.hle)\n"
+            "  -k <native>  Disable HLE hooks using this native\n"
+            "  -V           Check HLE hooks against the ROM code\n"
+            "  -R <MB>      Keep a rewind buffer of this size\n"
+            "  -w <cycles>  Go back this many cycles after running, needs -R\n"
+            "  -g <file>    Write sampled call stacks in folded flame graph format\n"
+            "  -G <cycles>  Call stack sampling interval (default 10000)\n"
+            "  -y <file>    Symbols naming call stack frames, lines of\n"
+            "               <hex address> <name>\n"
+            "  -b <file>    Run the benchmark script with every engine and exit\n"
+            "  -e <engine>  Only run the benchmark with plain, fused, idiom or\n"
+            "               full\n"
+            "  -x <a>[-<b>] Print references to and from hex address a, or\n"
+            "               range a to b, using <rom>.xref, and exit\n", name);
+    exit(1);
+}
 
 int main(int argc, char *argv[]) {
+    char *rom_file = "ROM.48G";
+    char *profile_file = NULL;
+    char *tcache_file = NULL;
+    char *xref_addr = NULL;
+    char *trace_file = NULL;
+    int trace_interval = 1024;
+    uint32_t trace_regs = TRACE_REG_ALL;
+    char *hle_file = NULL;
+    char *hle_disabled[16];
+    int hle_disabled_count = 0;
+    int rewind_mb = 0;
+    uint64_t rewind_back = 0;
+    char *sample_file = NULL;
+    uint64_t sample_interval = 10000;
+    char *symbol_file = NULL;
+    char *bench_file = NULL;
+    char *bench_engine = NULL;
+    bool use_tcache = true;
+    int list_count = 0;
+    uint64_t cycles = 100000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:l:c:p:FLMt:Tx:d:s:S:H:k:VR:w:g:G:y:b:e:")) != -1) {
+        switch (opt) {
+        case 'r': rom_file = optarg; break;
+        case 'l': list_count = atoi(optarg); break;
+        case 'c': cycles = strtoull(optarg, NULL, 0); break;
+        case 'p': profile_file = optarg; break;
+        case 'F': exec_fusion = false; break;
+        case 'L': idiom_enable = false; break;
+        case 'M': exec_direct = false; break;
+        case 't': tcache_file = optarg; break;
+        case 'T': use_tcache = false; break;
+        case 'x': xref_addr = optarg; break;
+        case 'd': trace_file = optarg; break;
+        case 's': trace_interval = atoi(optarg); break;
+        case 'S': trace_regs = parse_trace_regs(optarg); break;
+        case 'H': hle_file = optarg; break;
+        case 'k':
+            if (hle_disabled_count < 16)
+                hle_disabled[hle_disabled_count++] = optarg;
+            break;
+        case 'V': hle_verify = true; break;
+        case 'R': rewind_mb = atoi(optarg); break;
+        case 'w': rewind_back = strtoull(optarg, NULL, 0); break;
+        case 'g': sample_file = optarg; break;
+        case 'G': sample_interval = strtoull(optarg, NULL, 0); break;
+        case 'y': symbol_file = optarg; break;
+        case 'b': bench_file = optarg; break;
+        case 'e': bench_engine = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+
     printf("Hello\n");
 
-    uint8_t *rom = load_file("ROM.48G");
-    rom_init(rom);
+    size_t rom_size;
+    uint8_t *rom = load_file(rom_file, &rom_size);
+    rom_init(rom, rom_size);
+    emu_init();
+
+    if (list_count) {
+        emu_list(0, list_count);
+        return 0;
+    }
+
+    if (xref_addr) {
+        xref_query(rom_file, xref_addr);
+        return 0;
+    }
+
+    // Benchmarks translate every block again for each engine
+    if (bench_file)
+        use_tcache = false;
+
+    char default_tcache[1024];
+    if (use_tcache) {
+        if (!tcache_file) {
+            snprintf(default_tcache, sizeof(default_tcache), "%s.tcache",
+                    rom_file);
+            tcache_file = default_tcache;
+        }
+        tcache_open(tcache_file);
+    }
+
+    char default_hle[1024];
+    if (!hle_file) {
+        snprintf(default_hle, sizeof(default_hle), "%s.hle", rom_file);
+        hle_load(default_hle);
+    }
+    else if (hle_load(hle_file) < 0) {
+        fprintf(stderr, "Error: unable to open %s\n", hle_file);
+        exit(1);
+    }
+    for (int i = 0; i < hle_disabled_count; i++)
+        if (!hle_set(hle_disabled[i], false))
+            fprintf(stderr, "Warning: no HLE hook uses %s\n",
+                    hle_disabled[i]);
+
+    if (bench_file) {
+        if (!bench_run(bench_file, bench_engine)) {
+            fprintf(stderr, "Error: unable to run %s%s%s\n", bench_file,
+                    bench_engine ? " with engine " : "",
+                    bench_engine ? bench_engine : "");
+            exit(1);
+        }
+        return 0;
+    }
+
+    if (trace_file && !trace_open(trace_file, trace_regs & TRACE_REG_ALL,
+            trace_interval)) {
+        fprintf(stderr, "Error: unable to open %s\n", trace_file);
+        exit(1);
+    }
+
+    // Checkpoint about every 16 ms of guest time
+    if (rewind_mb && !rewind_open((size_t)rewind_mb << 20, 1 << 16)) {
+        fprintf(stderr, "Error: rewind buffer of %d MB is too small\n",
+                rewind_mb);
+        exit(1);
+    }
+
+    if (sample_file) {
+        if (!sample_open(sample_interval)) {
+            fprintf(stderr, "Error: invalid sampling interval\n");
+            exit(1);
+        }
+        if (symbol_file && (sample_symbols(symbol_file) < 0)) {
+            fprintf(stderr, "Error: unable to open %s\n", symbol_file);
+            exit(1);
+        }
+    }
+
+    emu_run(cycles);
+    trace_close();
+    printf("Stopped at PC %05x after %llu cycles\n", cpu.pc,
+            (unsigned long long)cpu.cycles);
+
+    if (sample_file) {
+        if (!sample_write(sample_file))
+            fprintf(stderr, "Error: unable to write %s\n", sample_file);
+        sample_close();
+    }
+    hle_report();
+
+    if (rewind_mb) {
+        int frames;
+        size_t bytes;
+        uint64_t oldest;
+        rewind_stats(&frames, &bytes, &oldest);
+        printf("Rewind: %d checkpoints in %zu bytes, back to cycle %llu\n",
+                frames, bytes, (unsigned long long)oldest);
+        uint64_t target = (cpu.cycles > rewind_back) ?
+                cpu.cycles - rewind_back : 0;
+        if (rewind_back && rewind_to(target)) {
+            emu_run(target - cpu.cycles);
+            printf("Rewound to PC %05x at cycle %llu\n", cpu.pc,
+                    (unsigned long long)cpu.cycles);
+        }
+        else if (rewind_back) {
+            fprintf(stderr, "Error: cycle %llu is not in the rewind buffer\n",
+                    (unsigned long long)target);
+        }
+        rewind_close();
+    }
+
+    if (use_tcache) {
+        int hits, new_blocks;
+        tcache_stats(&hits, &new_blocks);
+        printf("Translation cache: %d blocks loaded, %d added\n", hits,
+                new_blocks);
+        if (!tcache_save())
+            fprintf(stderr, "Error: unable to write %s\n", tcache_file);
+        tcache_close();
+    }
 
-    emu_main();
+    if (profile_file)
+        cpu_profile_dump(profile_file);
+    return 0;
 }
 
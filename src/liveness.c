@@ -0,0 +1,366 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "disasm.h"
+#include "memory.h"
+#include "translate.h"
+#include "liveness.h"
+
+// Backward liveness analysis of carry and working register nibbles over a
+// translated block. Each of A, B, C and D takes 16 bits in a 64 bit set, one
+// per nibble. Uops writing a carry nobody reads get UF_NO_CARRY, uops whose
+// result is never read and have no other side effect get UF_DEAD.
+//
+// The live set at block exit is the union of the live set at entry of each
+// statically known successor, itself computed assuming everything is live at
+// its exit. Indirect exits (RTN, PC=(A), ...) keep everything live, and so do
+// successors outside of ROM, as their code may change later.
+
+#define LIVE_ALL    (~(uint64_t)0)
+#define P_UNKNOWN   (-1)
+
+typedef struct {
+    uint64_t use;       // Nibbles read
+    uint64_t def;       // Nibbles always written
+    uint64_t may_def;   // Nibbles possibly written
+    bool carry_use;     // Reads the carry set by previous uops
+    bool carry_def;
+    bool carry_keep;    // Consumes its own carry result (test and branch)
+    bool pure;          // No effect besides working registers and carry
+} EFFECT;
+
+// Nibble mask of a field, or -1 if it depends on an unknown P
+static int32_t field_mask(int field, int p) {
+    static const uint16_t masks[] = {
+        0, 0, 0x0004, 0x0007, 0x8000, 0x7ff8, 0x0003, 0xffff, 0x001f
+    };
+    if ((field == F_P) || (field == F_WP)) {
+        if (p == P_UNKNOWN)
+            return -1;
+        return (field == F_P) ? (1 << p) : ((2 << p) - 1);
+    }
+    if (field > F_A)
+        return (1 << (field - F_A)) - 1;
+    return masks[field];
+}
+
+static void use_mask(EFFECT *e, int reg, int32_t mask) {
+    if (mask < 0)
+        mask = 0xffff;
+    e->use |= (uint64_t)mask << (reg * 16);
+}
+
+static void def_mask(EFFECT *e, int reg, int32_t mask) {
+    if (mask < 0) {
+        e->may_def |= (uint64_t)0xffff << (reg * 16);
+        return;
+    }
+    e->def |= (uint64_t)mask << (reg * 16);
+    e->may_def |= (uint64_t)mask << (reg * 16);
+}
+
+static void get_effect(const UOP *u, int p, EFFECT *e) {
+    int32_t fmask = field_mask(u->field, p);
+    int32_t mask;
+
+    e->use = e->def = e->may_def = 0;
+    e->carry_use = e->carry_def = e->carry_keep = e->pure = false;
+
+    switch (u->op) {
+    case UOP_ADD: case UOP_SUB: case UOP_RSUB:
+        use_mask(e, u->src, fmask);
+        // fall through
+    case UOP_INC: case UOP_DEC: case UOP_ADDCON: case UOP_SUBCON:
+    case UOP_NEG: case UOP_NOT:
+        use_mask(e, u->dst, fmask);
+        def_mask(e, u->dst, fmask);
+        e->carry_def = true;
+        e->pure = true;
+        break;
+    case UOP_AND: case UOP_OR:
+        use_mask(e, u->src, fmask);
+        use_mask(e, u->dst, fmask);
+        def_mask(e, u->dst, fmask);
+        e->pure = true;
+        break;
+    case UOP_ZERO:
+    case UOP_RLOD:
+        def_mask(e, u->dst, fmask);
+        e->pure = true;
+        break;
+    case UOP_COPY:
+        use_mask(e, u->src, fmask);
+        def_mask(e, u->dst, fmask);
+        e->pure = true;
+        break;
+    case UOP_EXCH:
+        use_mask(e, u->src, fmask);
+        use_mask(e, u->dst, fmask);
+        def_mask(e, u->src, fmask);
+        def_mask(e, u->dst, fmask);
+        e->pure = true;
+        break;
+    case UOP_SL: case UOP_SR: case UOP_SRB: case UOP_SLC: case UOP_SRC:
+        // Shifts also update SB
+    case UOP_REXC:
+        use_mask(e, u->dst, fmask);
+        def_mask(e, u->dst, fmask);
+        break;
+    case UOP_TEQ: case UOP_TNE: case UOP_TGT: case UOP_TLT:
+    case UOP_TGE: case UOP_TLE:
+        use_mask(e, u->src, fmask);
+        // fall through
+    case UOP_TZ: case UOP_TNZ:
+        use_mask(e, u->dst, fmask);
+        e->carry_def = e->carry_keep = true;
+        break;
+    case UOP_RSTO:
+        use_mask(e, u->src, fmask);
+        break;
+    case UOP_LOAD:
+        def_mask(e, u->dst, fmask);
+        break;
+    case UOP_STORE:
+        use_mask(e, u->src, fmask);
+        break;
+    case UOP_DADD: case UOP_DSUB: case UOP_PINC: case UOP_PDEC:
+        e->carry_def = true;
+        break;
+    case UOP_DCOPY:
+        use_mask(e, u->src, (1 << u->imm) - 1);
+        break;
+    case UOP_DEXCH:
+        use_mask(e, u->src, (1 << u->imm) - 1);
+        def_mask(e, u->src, (1 << u->imm) - 1);
+        break;
+    case UOP_TPEQ: case UOP_TPNE: case UOP_TST0: case UOP_TST1:
+    case UOP_THS0:
+        e->carry_def = e->carry_keep = true;
+        break;
+    case UOP_PTOC:
+        def_mask(e, R_C, 1 << u->imm);
+        e->pure = true;
+        break;
+    case UOP_CTOP:
+        use_mask(e, R_C, 1 << u->imm);
+        break;
+    case UOP_CPEX:
+        use_mask(e, R_C, 1 << u->imm);
+        def_mask(e, R_C, 1 << u->imm);
+        break;
+    case UOP_CPP1:
+        use_mask(e, R_C, 0x1f);
+        def_mask(e, R_C, 0x1f);
+        e->carry_def = true;
+        e->pure = true;
+        break;
+    case UOP_LHEX:
+        // Loads src nibbles starting at nibble P, wrapping around
+        mask = 0;
+        if (p == P_UNKNOWN)
+            mask = -1;
+        else
+            for (int i = 0; i < u->src; i++)
+                mask |= 1 << ((p + i) & 0xf);
+        def_mask(e, u->dst, mask);
+        e->pure = true;
+        break;
+    case UOP_CST:
+        def_mask(e, R_C, 0x7);
+        e->pure = true;
+        break;
+    case UOP_STC: case UOP_OUTC:
+        use_mask(e, R_C, 0x7);
+        break;
+    case UOP_CSTEX:
+        use_mask(e, R_C, 0x7);
+        def_mask(e, R_C, 0x7);
+        break;
+    case UOP_BIT0: case UOP_BIT1:
+        use_mask(e, u->dst, 1 << (u->imm >> 2));
+        def_mask(e, u->dst, 1 << (u->imm >> 2));
+        break;
+    case UOP_TBIT0: case UOP_TBIT1:
+        use_mask(e, u->dst, 1 << (u->imm >> 2));
+        e->carry_def = e->carry_keep = true;
+        break;
+    case UOP_GOC: case UOP_GONC: case UOP_RTNC: case UOP_RTNNC:
+        e->carry_use = true;
+        break;
+    case UOP_RTNSC: case UOP_RTNCC:
+        e->carry_def = true;
+        break;
+    case UOP_JUMPI: case UOP_PCREG: case UOP_UNCNFG: case UOP_CONFIG:
+        use_mask(e, u->dst, 0x1f);
+        break;
+    case UOP_REGPC: case UOP_CID:
+        def_mask(e, u->dst, 0x1f);
+        break;
+    case UOP_PCEX:
+        use_mask(e, u->dst, 0x1f);
+        def_mask(e, u->dst, 0x1f);
+        break;
+    case UOP_PUSHC:
+        use_mask(e, R_C, 0x1f);
+        break;
+    case UOP_POPC:
+        def_mask(e, R_C, 0x1f);
+        break;
+    case UOP_OUTCS:
+        use_mask(e, R_C, 0x1);
+        break;
+    case UOP_IN:
+        def_mask(e, u->dst, 0xf);
+        break;
+    case UOP_SREQ:
+        def_mask(e, R_C, 0x1);
+        break;
+    case UOP_ILLEGAL:
+        e->use = LIVE_ALL;
+        e->carry_use = true;
+        break;
+    default:
+        break;
+    }
+}
+
+// Track P through the block, returns the value after the uop
+static int update_p(const UOP *u, int p) {
+    switch (u->op) {
+    case UOP_PSET:
+        return u->imm;
+    case UOP_PINC:
+        return (p == P_UNKNOWN) ? p : ((p + 1) & 0xf);
+    case UOP_PDEC:
+        return (p == P_UNKNOWN) ? p : ((p - 1) & 0xf);
+    case UOP_CTOP: case UOP_CPEX: case UOP_ILLEGAL:
+        return P_UNKNOWN;
+    default:
+        return p;
+    }
+}
+
+// Run the backward pass over a decoded block. If mark is set, flag the uops
+// with dead results and count them in the block.
+static void analyze(BLOCK *block, uint64_t *live, bool *carry, bool mark) {
+    int p[BLOCK_MAX_UOPS];
+    int cur_p = P_UNKNOWN;
+    EFFECT e;
+
+    for (int i = 0; i < block->count; i++) {
+        p[i] = cur_p;
+        cur_p = update_p(&block->uop[i], cur_p);
+    }
+
+    for (int i = block->count - 1; i >= 0; i--) {
+        UOP *u = &block->uop[i];
+        get_effect(u, p[i], &e);
+        bool carry_dead = e.carry_def && !e.carry_keep && !*carry;
+        if (e.pure && !(e.may_def & *live) && (!e.carry_def || carry_dead)) {
+            // Removed completely, it neither reads nor writes anything
+            if (mark) {
+                u->flags |= UF_DEAD;
+                block->dead_elided++;
+                if (e.carry_def) {
+                    u->flags |= UF_NO_CARRY;
+                    block->carry_elided++;
+                }
+            }
+            continue;
+        }
+        if (carry_dead && mark) {
+            u->flags |= UF_NO_CARRY;
+            block->carry_elided++;
+        }
+        *live = (*live & ~e.def) | e.use;
+        if (e.carry_def)
+            *carry = false;
+        if (e.carry_use)
+            *carry = true;
+    }
+}
+
+static void live_in(uint32_t pc, uint64_t *live, bool *carry) {
+    BLOCK block;
+    uint64_t block_live = LIVE_ALL;
+    bool block_carry = true;
+    if (memory_map(pc) != MEM_ROM) {
+        *live = LIVE_ALL;
+        *carry = true;
+        return;
+    }
+    translate_decode(&block, pc);
+    analyze(&block, &block_live, &block_carry, false);
+    *live |= block_live;
+    *carry |= block_carry;
+}
+
+static void live_out(const BLOCK *block, uint64_t *live, bool *carry) {
+    const UOP *u = &block->uop[block->count - 1];
+    *live = 0;
+    *carry = false;
+    if (!translate_ends_block(u)) {
+        live_in(block->end, live, carry);
+        return;
+    }
+    switch (u->op) {
+    case UOP_GOTO:
+    case UOP_GOSUB:
+        live_in(u->target, live, carry);
+        break;
+    case UOP_TEQ: case UOP_TNE: case UOP_TZ: case UOP_TNZ:
+    case UOP_TGT: case UOP_TLT: case UOP_TGE: case UOP_TLE:
+    case UOP_TPEQ: case UOP_TPNE: case UOP_TST0: case UOP_TST1:
+    case UOP_THS0: case UOP_TBIT0: case UOP_TBIT1:
+    case UOP_GOC: case UOP_GONC:
+        if (u->flags & UF_RTNYES) {
+            *live = LIVE_ALL;
+            *carry = true;
+            break;
+        }
+        live_in(u->target, live, carry);
+        live_in(block->end, live, carry);
+        break;
+    default:
+        *live = LIVE_ALL;
+        *carry = true;
+        break;
+    }
+}
+
+void liveness_block(BLOCK *block) {
+    uint64_t live;
+    bool carry;
+
+    block->carry_elided = 0;
+    block->dead_elided = 0;
+    for (int i = 0; i < block->count; i++)
+        block->uop[i].flags &= ~(UF_NO_CARRY | UF_DEAD);
+
+    live_out(block, &live, &carry);
+    analyze(block, &live, &carry, true);
+}
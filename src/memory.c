@@ -0,0 +1,323 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "memory.h"
+#include "rom.h"
+#include "ram.h"
+#include "io.h"
+#include "cpu.h"
+
+// Saturn memory bus. Modules are mapped with CONFIG in daisy chain order,
+// the ROM answers every address not claimed by another module. Port modules
+// (CE1, CE2, NCE3) have nothing plugged in and read as 0.
+
+// C=ID values, RAM also reports its size
+static const uint32_t module_id[MEM_COUNT] = {
+    0x00019, ((0x100000 - RAM_NIBBLES) & 0xff000) | 0x003, 0x00005, 0x00007,
+    0x00001
+};
+
+static MODULE modules[MEM_COUNT];
+// Pages holding translated code, see cpu_invalidate()
+uint8_t code_page[CODE_PAGES];
+// Write log, see memory_log_start()
+static MEM_LOG *mem_log;
+static int mem_log_size;
+static int mem_log_count;
+
+void memory_reset() {
+    memset(modules, 0, sizeof(modules));
+    // MMIO has a fixed size and is configured with a single CONFIG
+    modules[MEM_IO].mask = (0x100000 - IO_SIZE) & ADDR_MASK;
+    modules[MEM_IO].sized = true;
+}
+
+void memory_init() {
+    ram_init();
+    io_init();
+    memory_reset();
+}
+
+int memory_map(uint32_t address) {
+    for (int i = 0; i < MEM_COUNT; i++) {
+        if (modules[i].configured &&
+                ((address & modules[i].mask) == modules[i].base))
+            return i;
+    }
+    return MEM_ROM;
+}
+
+// Copy of the bus configuration, for snapshots
+void memory_save(MODULE *state) {
+    memcpy(state, modules, sizeof(modules));
+}
+
+void memory_restore(const MODULE *state) {
+    memcpy(modules, state, sizeof(modules));
+    cpu_flush_blocks();
+}
+
+// Base address of the MMIO window, false while it is not configured. MMIO
+// comes first in the chain, so the whole window always maps to it.
+bool memory_io_base(uint32_t *base) {
+    *base = modules[MEM_IO].base;
+    return modules[MEM_IO].configured;
+}
+
+// Offset of the address inside a module other than the ROM, which has no
+// entry in modules[]
+static uint32_t module_offset(int module, uint32_t address) {
+    return address & ~modules[module].mask & ADDR_MASK;
+}
+
+// Offset of the address inside the module it maps to
+uint32_t memory_offset(uint32_t address) {
+    int module = memory_map(address);
+    if (module == MEM_ROM)
+        return address;
+    return module_offset(module, address);
+}
+
+uint8_t memory_read_nibble(uint32_t address) {
+    address &= ADDR_MASK;
+    int module = memory_map(address);
+    switch (module) {
+    case MEM_IO: return io_read(module_offset(module, address));
+    case MEM_RAM: return ram_read(module_offset(module, address) % RAM_NIBBLES);
+    case MEM_ROM: return rom_read(address);
+    default: return 0;
+    }
+}
+
+void memory_write_nibble(uint32_t address, uint8_t value) {
+    address &= ADDR_MASK;
+    int module = memory_map(address);
+    if (mem_log && (module == MEM_IO || module == MEM_RAM)) {
+        if (mem_log_count < mem_log_size) {
+            mem_log[mem_log_count].address = address;
+            mem_log[mem_log_count].old_value = memory_read_nibble(address);
+            mem_log[mem_log_count].new_value = value & 0xf;
+        }
+        mem_log_count++;
+    }
+    switch (module) {
+    case MEM_IO:
+        io_write(module_offset(module, address), value);
+        break;
+    case MEM_RAM:
+        if (code_page[address >> PAGE_SHIFT])
+            cpu_invalidate(address);
+        ram_write(module_offset(module, address) % RAM_NIBBLES, value & 0xf);
+        break;
+    default:
+        // Writes to ROM and empty ports are ignored
+        break;
+    }
+}
+
+// Offset in RAM of a range of n nibbles if it is all in RAM without
+// wrapping around the module, or -1. Only MMIO comes before RAM in the
+// chain, so it is the only module that can hide in the middle of the range.
+static int64_t ram_range(uint32_t address, uint32_t n) {
+    uint32_t base;
+    uint32_t last = (address + n - 1) & ADDR_MASK;
+    if ((memory_map(address) != MEM_RAM) || (memory_map(last) != MEM_RAM))
+        return -1;
+    if (memory_io_base(&base) && (((base - address) & ADDR_MASK) < n))
+        return -1;
+    uint32_t mask = ~modules[MEM_RAM].mask & ADDR_MASK;
+    uint32_t start = (address & mask) % RAM_NIBBLES;
+    uint32_t end = (last & mask) % RAM_NIBBLES;
+    if (end - start != n - 1)
+        return -1;
+    return start;
+}
+
+// Write n nibbles at offset in RAM, address is where the range is mapped
+static void ram_write_range(uint32_t address, uint32_t offset, uint64_t value,
+        int n) {
+    if (code_page[address >> PAGE_SHIFT])
+        cpu_invalidate(address);
+    if (code_page[((address + n - 1) & ADDR_MASK) >> PAGE_SHIFT])
+        cpu_invalidate((address + n - 1) & ADDR_MASK);
+    ram_store(offset, value, n);
+}
+
+// Ranges of several nibbles all in RAM take a single ram_load() or
+// ram_store(), anything else goes through the bus one nibble at a time
+uint64_t memory_read(uint32_t address, int n) {
+    int64_t offset = (n > 1) ? ram_range(address & ADDR_MASK, n) : -1;
+    if (offset >= 0)
+        return ram_load(offset, n);
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++)
+        value |= (uint64_t)memory_read_nibble(address + i) << (i * 4);
+    return value;
+}
+
+void memory_write(uint32_t address, uint64_t value, int n) {
+    int64_t offset = (n > 1) ? ram_range(address & ADDR_MASK, n) : -1;
+    if ((offset >= 0) && !mem_log) {
+        ram_write_range(address & ADDR_MASK, offset, value, n);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        memory_write_nibble(address + i, value & 0xf);
+        value >>= 4;
+    }
+}
+
+void memory_config(uint32_t value) {
+    for (int i = 0; i < MEM_COUNT; i++) {
+        MODULE *m = &modules[i];
+        if (m->configured)
+            continue;
+        if (!m->sized) {
+            m->mask = value & ADDR_MASK;
+            m->sized = true;
+        }
+        else {
+            m->base = value & m->mask;
+            m->configured = true;
+        }
+        break;
+    }
+    cpu_flush_blocks();
+}
+
+void memory_unconfig(uint32_t address) {
+    int module = memory_map(address & ADDR_MASK);
+    if (module == MEM_ROM)
+        return;
+    modules[module].configured = false;
+    modules[module].sized = (module == MEM_IO);
+    cpu_flush_blocks();
+}
+
+uint32_t memory_id() {
+    for (int i = 0; i < MEM_COUNT; i++) {
+        if (!modules[i].configured)
+            return module_id[i];
+    }
+    return 0;
+}
+
+// Record that translated code was read from this range, so writes to it
+// invalidate translated blocks
+void memory_mark_code(uint32_t address, int n) {
+    for (int i = 0; i < n; i += PAGE_SIZE)
+        code_page[((address + i) & ADDR_MASK) >> PAGE_SHIFT] = 1;
+    code_page[((address + n - 1) & ADDR_MASK) >> PAGE_SHIFT] = 1;
+}
+
+// Copy n nibbles from src to dst with memmove semantics
+void memory_move(uint32_t dst, uint32_t src, uint32_t n) {
+    if (!n)
+        return;
+    int64_t d = ram_range(dst, n);
+    int64_t s = ram_range(src, n);
+    if ((d >= 0) && (s >= 0) && !mem_log) {
+        for (uint32_t i = 0; i < n; i += PAGE_SIZE)
+            if (code_page[((dst + i) & ADDR_MASK) >> PAGE_SHIFT])
+                cpu_invalidate((dst + i) & ADDR_MASK);
+        if (code_page[((dst + n - 1) & ADDR_MASK) >> PAGE_SHIFT])
+            cpu_invalidate((dst + n - 1) & ADDR_MASK);
+        ram_move(d, s, n);
+        return;
+    }
+    if (((dst - src) & ADDR_MASK) < n) {
+        for (uint32_t i = n; i-- > 0;)
+            memory_write_nibble(dst + i, memory_read_nibble(src + i));
+    }
+    else {
+        for (uint32_t i = 0; i < n; i++)
+            memory_write_nibble(dst + i, memory_read_nibble(src + i));
+    }
+}
+
+// Module holding all n nibbles from address at consecutive offsets, with the
+// offset of the first one, or -1. Only RAM, MMIO and ROM are resolved. The
+// result holds until the next CONFIG or UNCONFIG, which flush all blocks.
+int memory_resolve(uint32_t address, int n, uint32_t *offset) {
+    uint32_t last = (address + n - 1) & ADDR_MASK;
+    int module = memory_map(address);
+    if (last < address)
+        return -1;
+    for (int i = 1; i < n; i++)
+        if (memory_map(address + i) != module)
+            return -1;
+    switch (module) {
+    case MEM_RAM:
+        *offset = memory_offset(address) % RAM_NIBBLES;
+        if (memory_offset(last) % RAM_NIBBLES != *offset + n - 1)
+            return -1;
+        return module;
+    case MEM_IO:
+        *offset = memory_offset(address);
+        return module;
+    case MEM_ROM:
+        *offset = address;
+        return module;
+    default:
+        return -1;
+    }
+}
+
+// Write n nibbles to a range resolved by memory_resolve(), skipping the bus
+void memory_write_direct(int module, uint32_t address, uint32_t offset,
+        uint64_t value, int n) {
+    if (mem_log) {
+        memory_write(address, value, n);
+        return;
+    }
+    switch (module) {
+    case MEM_IO:
+        for (int i = 0; i < n; i++, value >>= 4)
+            io_write(offset + i, value & 0xf);
+        break;
+    case MEM_RAM:
+        ram_write_range(address, offset, value, n);
+        break;
+    default:
+        break;
+    }
+}
+
+// Record every write to RAM and MMIO into log, up to size entries
+void memory_log_start(MEM_LOG *log, int size) {
+    mem_log = log;
+    mem_log_size = size;
+    mem_log_count = 0;
+}
+
+// Stop recording, returns the number of writes, which may exceed the log
+// size if it overflowed
+int memory_log_stop() {
+    mem_log = NULL;
+    return mem_log_count;
+}
@@ -0,0 +1,78 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+// Modules on the memory bus, in daisy chain order for CONFIG
+typedef enum {
+    MEM_IO,
+    MEM_RAM,
+    MEM_CE1,
+    MEM_CE2,
+    MEM_NCE3,
+    MEM_ROM,
+    MEM_COUNT = MEM_ROM
+} MEM_MODULE;
+
+#define IO_SIZE         (0x40) // MMIO window size, in nibbles
+#define PAGE_SHIFT      (8)
+#define PAGE_SIZE       (1 << PAGE_SHIFT)
+
+// Bus configuration of a module
+typedef struct {
+    uint32_t base;
+    uint32_t mask;      // Address mask, set from the module size
+    bool sized;         // Size has been configured
+    bool configured;    // Base address has been configured
+} MODULE;
+
+typedef struct {
+    uint32_t address;
+    uint8_t old_value;
+    uint8_t new_value;
+} MEM_LOG;
+
+void memory_init();
+void memory_reset();
+int memory_map(uint32_t address);
+bool memory_io_base(uint32_t *base);
+uint32_t memory_offset(uint32_t address);
+uint8_t memory_read_nibble(uint32_t address);
+void memory_write_nibble(uint32_t address, uint8_t value);
+uint64_t memory_read(uint32_t address, int n);
+void memory_write(uint32_t address, uint64_t value, int n);
+void memory_config(uint32_t value);
+void memory_unconfig(uint32_t address);
+uint32_t memory_id();
+void memory_save(MODULE *state);
+void memory_restore(const MODULE *state);
+void memory_mark_code(uint32_t address, int n);
+void memory_move(uint32_t dst, uint32_t src, uint32_t n);
+int memory_resolve(uint32_t address, int n, uint32_t *offset);
+void memory_write_direct(int module, uint32_t address, uint32_t offset,
+        uint64_t value, int n);
+void memory_log_start(MEM_LOG *log, int size);
+int memory_log_stop();
+
+#define CODE_PAGES      ((ADDR_MASK + 1) >> PAGE_SHIFT)
+
+extern uint8_t code_page[CODE_PAGES];
@@ -0,0 +1,271 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "translate.h"
+#include "memory.h"
+#include "cpu.h"
+#include "object.h"
+
+// RPL objects, as nibble arrays in address order. Objects are loaded from
+// binary object files: "HPHP48-" and a version letter, then the object two
+// nibbles per byte, low nibble first.
+//
+// Injection works on a paused machine, where the RPL pointers are saved in
+// RAM, as the ROM does before going idle. The 48G layout is assumed to be,
+// from low to high addresses: temporary objects from TEMPOB up to TEMPTOP,
+// the RPL return stack up to RSKTOP, free memory, then the data stack of
+// 5 nibble object pointers from DSKTOP up to the command line at EDITLINE.
+// Each temporary object is followed by a 5 nibble link holding its size
+// plus 5. Pushing an object moves the return stack up to make room in
+// TEMPOB, then adds a pointer at the top of the data stack. Storing it in
+// a directory is left to the calculator.
+
+// 48G system RAM pointers
+#define TEMPOB      (0x806e9)
+#define TEMPTOP     (0x806ee)
+#define RSKTOP      (0x806f3)
+#define DSKTOP      (0x806f8)
+#define EDITLINE    (0x806fd)
+
+// Prologs
+#define DOBINT      (0x02911)
+#define DOREAL      (0x02933)
+#define DOEREL      (0x02955)
+#define DOCMP       (0x02977)
+#define DOECMP      (0x0299d)
+#define DOCHAR      (0x029bf)
+#define DOARRY      (0x029e8)
+#define DOLNKARRY   (0x02a0a)
+#define DOCSTR      (0x02a2c)
+#define DOHSTR      (0x02a4e)
+#define DOLIST      (0x02a74)
+#define DORRP       (0x02a96)
+#define DOSYMB      (0x02ab8)
+#define DOEXT       (0x02ada)
+#define DOTAG       (0x02afc)
+#define DOGROB      (0x02b1e)
+#define DOLIB       (0x02b40)
+#define DOBAK       (0x02b62)
+#define DOEXT0      (0x02b88)
+#define DOCOL       (0x02d9d)
+#define DOCODE      (0x02dcc)
+#define DOIDNT      (0x02e48)
+#define DOLAM       (0x02e6d)
+#define DOROMP      (0x02e92)
+#define SEMI        (0x0312b)
+
+#define MAX_DEPTH   (64) // Composite nesting
+
+static const char header[] = "HPHP48-";
+
+static uint32_t get(const uint8_t *obj, int pos, int n) {
+    uint32_t value = 0;
+    for (int i = n - 1; i >= 0; i--)
+        value = (value << 4) | obj[pos + i];
+    return value;
+}
+
+static bool is_prolog(uint32_t value) {
+    switch (value) {
+    case DOBINT: case DOREAL: case DOEREL: case DOCMP: case DOECMP:
+    case DOCHAR: case DOARRY: case DOLNKARRY: case DOCSTR: case DOHSTR:
+    case DOLIST: case DORRP: case DOSYMB: case DOEXT: case DOTAG:
+    case DOGROB: case DOLIB: case DOBAK: case DOEXT0: case DOCOL:
+    case DOCODE: case DOIDNT: case DOLAM: case DOROMP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// End of the object starting at pos, or -1 if it is unknown or goes past n
+static int skip(const uint8_t *obj, int n, int pos, int depth) {
+    if ((pos + 5 > n) || (depth > MAX_DEPTH))
+        return -1;
+    int end;
+    switch (get(obj, pos, 5)) {
+    case DOBINT: end = pos + 10; break;
+    case DOREAL: end = pos + 21; break;
+    case DOEREL: end = pos + 26; break;
+    case DOCMP: end = pos + 37; break;
+    case DOECMP: end = pos + 47; break;
+    case DOCHAR: end = pos + 7; break;
+    case DOROMP: end = pos + 11; break;
+    case DOIDNT:
+    case DOLAM:
+        if (pos + 7 > n)
+            return -1;
+        end = pos + 7 + get(obj, pos + 5, 2) * 2;
+        break;
+    case DOTAG:
+        if (pos + 7 > n)
+            return -1;
+        end = skip(obj, n, pos + 7 + get(obj, pos + 5, 2) * 2, depth + 1);
+        break;
+    case DOARRY: case DOLNKARRY: case DOCSTR: case DOHSTR: case DOGROB:
+    case DOLIB: case DOBAK: case DOEXT0: case DOCODE:
+        // The length includes its own 5 nibbles
+        if (pos + 10 > n)
+            return -1;
+        end = pos + 5 + get(obj, pos + 5, 5);
+        break;
+    case DOLIST: case DOSYMB: case DOEXT: case DOCOL:
+        // Objects and pointers to objects up to SEMI
+        for (pos += 5; (pos + 5 <= n) && (get(obj, pos, 5) != SEMI);) {
+            if (is_prolog(get(obj, pos, 5)))
+                pos = skip(obj, n, pos, depth + 1);
+            else
+                pos += 5;
+            if (pos < 0)
+                return -1;
+        }
+        end = pos + 5;
+        break;
+    default:
+        // Directories are not handled
+        return -1;
+    }
+    return (end <= n) ? end : -1;
+}
+
+// Size in nibbles of the object in the first n nibbles of obj, or -1
+int object_size(const uint8_t *obj, int n) {
+    return skip(obj, n, 0, 0);
+}
+
+// Read a binary object file, returns its size in nibbles or -1
+int object_load(const char *fn, uint8_t **obj) {
+    FILE *fp = fopen(fn, "rb");
+    if (!fp)
+        return -1;
+    char magic[8];
+    uint8_t *data = malloc(OBJECT_MAX / 2);
+    size_t bytes = 0;
+    if (data && (fread(magic, 8, 1, fp) == 1) &&
+            !memcmp(magic, header, sizeof(header) - 1))
+        bytes = fread(data, 1, OBJECT_MAX / 2, fp);
+    fclose(fp);
+    *obj = malloc(bytes * 2 + 1);
+    if (!bytes || !*obj) {
+        free(data);
+        free(*obj);
+        return -1;
+    }
+    for (size_t i = 0; i < bytes; i++) {
+        (*obj)[i * 2] = data[i] & 0xf;
+        (*obj)[i * 2 + 1] = data[i] >> 4;
+    }
+    free(data);
+    // Files hold whole bytes, the object may end one nibble earlier
+    int size = object_size(*obj, bytes * 2);
+    if (size < 0) {
+        free(*obj);
+        *obj = NULL;
+    }
+    return size;
+}
+
+static bool in_ram(uint32_t address) {
+    return memory_map(address & ADDR_MASK) == MEM_RAM;
+}
+
+// Add a copy of the object to TEMPOB and push it on the data stack, returns
+// false if the RPL pointers are not sane or memory is full
+bool object_push(const uint8_t *obj, int size, uint32_t *address) {
+    uint32_t tempob = memory_read(TEMPOB, 5);
+    uint32_t temptop = memory_read(TEMPTOP, 5);
+    uint32_t rsktop = memory_read(RSKTOP, 5);
+    uint32_t dsktop = memory_read(DSKTOP, 5);
+    uint32_t editline = memory_read(EDITLINE, 5);
+    if (!in_ram(TEMPOB) || !in_ram(tempob) || !in_ram(editline) ||
+            (tempob > temptop) || (temptop > rsktop) || (rsktop > dsktop) ||
+            (dsktop > editline) || (size <= 0))
+        return false;
+    // Object, its link and the stack pointer must fit in free memory
+    uint32_t room = size + 5;
+    if ((uint64_t)rsktop + room + 5 > dsktop)
+        return false;
+
+    memory_move(temptop + room, temptop, rsktop - temptop);
+    for (int i = 0; i < size; i += 16) {
+        int n = (size - i < 16) ? size - i : 16;
+        uint64_t value = 0;
+        for (int j = n - 1; j >= 0; j--)
+            value = (value << 4) | obj[i + j];
+        memory_write(temptop + i, value, n);
+    }
+    memory_write(temptop + size, room, 5);
+    memory_write(dsktop - 5, temptop, 5);
+
+    // Registers still holding the saved pointers follow them
+    if (cpu.d[1] == dsktop)
+        cpu.d[1] = dsktop - 5;
+    if ((cpu.reg[R_B] & ADDR_MASK) == rsktop)
+        cpu.reg[R_B] = (cpu.reg[R_B] & ~(uint64_t)ADDR_MASK) | (rsktop + room);
+    memory_write(TEMPTOP, temptop + room, 5);
+    memory_write(RSKTOP, rsktop + room, 5);
+    memory_write(DSKTOP, dsktop - 5, 5);
+    *address = temptop;
+    return true;
+}
+
+// Copy of the object at stack level (1 for the top), returns its size or -1
+int object_read(int level, uint8_t **obj, uint32_t *address) {
+    uint32_t dsktop = memory_read(DSKTOP, 5);
+    uint32_t editline = memory_read(EDITLINE, 5);
+    if ((level < 1) || (dsktop > editline))
+        return -1;
+    uint64_t slot = dsktop + (uint64_t)(level - 1) * 5;
+    if (slot + 5 > editline)
+        return -1;
+    *address = memory_read(slot, 5);
+    if (!*address)
+        return -1; // Past the stack bottom marker
+    // Read more until the whole object is in, most objects are small
+    int limit = ADDR_MASK + 1 - *address;
+    if (limit > OBJECT_MAX)
+        limit = OBJECT_MAX;
+    int size = -1;
+    *obj = NULL;
+    for (int n = 0, want = 256; (size < 0) && (n < limit); want *= 2) {
+        if (want > limit)
+            want = limit;
+        uint8_t *p = realloc(*obj, want);
+        if (!p)
+            break;
+        *obj = p;
+        for (; n < want; n++)
+            p[n] = memory_read_nibble(*address + n);
+        size = object_size(p, n);
+    }
+    if (size < 0) {
+        free(*obj);
+        *obj = NULL;
+    }
+    return size;
+}
@@ -24,15 +24,120 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "config.h"
 #include "ram.h"
 
-static uint8_t ram[RAM_SIZE];
+// System RAM. With RAM_PACKED, nibble i is in byte i / 2, low half first, so
+// reading any run of up to 16 nibbles takes one 64 bit load, or two when it
+// starts on an odd nibble and is 16 long. This assumes a little endian host.
+// The padding keeps loads at the end of RAM inside the array.
+
+#if RAM_PACKED
+#define RAM_BYTES   (RAM_NIBBLES / 2 + 8)
+#else
+#define RAM_BYTES   RAM_SIZE
+#endif
+
+static uint8_t ram[RAM_BYTES];
+uint8_t ram_dirty[RAM_PAGES];
 
 void ram_init() {
-    memset(ram, 0, RAM_SIZE);
+    memset(ram, 0, RAM_BYTES);
+    memset(ram_dirty, 1, RAM_PAGES);
 }
 
 uint8_t *ram_get_ptr(size_t address) {
+#if RAM_PACKED
+    return &ram[address / 2];
+#else
     return &ram[address];
+#endif
+}
+
+void ram_write(size_t address, uint8_t value) {
+#if RAM_PACKED
+    int shift = (address & 1) * 4;
+    uint8_t *p = &ram[address / 2];
+    *p = (*p & ~(0xf << shift)) | ((value & 0xf) << shift);
+#else
+    ram[address] = value;
+#endif
+    ram_dirty[address >> RAM_PAGE_SHIFT] = 1;
+}
+
+uint8_t ram_read(size_t address) {
+#if RAM_PACKED
+    return (ram[address / 2] >> ((address & 1) * 4)) & 0xf;
+#else
+    return ram[address];
+#endif
+}
+
+static inline uint64_t nib_mask(int n) {
+    return (n >= 16) ? ~(uint64_t)0 : (((uint64_t)1 << (n * 4)) - 1);
+}
+
+// Read n nibbles starting at address, lowest nibble first
+uint64_t ram_load(size_t address, int n) {
+#if RAM_PACKED
+    uint64_t word;
+    int shift = (address & 1) * 4;
+    memcpy(&word, &ram[address / 2], sizeof(word));
+    word >>= shift;
+    if (shift && (n == 16))
+        word |= (uint64_t)ram[address / 2 + 8] << 60;
+    return word & nib_mask(n);
+#else
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++)
+        value |= (uint64_t)ram[address + i] << (i * 4);
+    return value;
+#endif
+}
+
+void ram_store(size_t address, uint64_t value, int n) {
+    ram_dirty[address >> RAM_PAGE_SHIFT] = 1;
+    ram_dirty[(address + n - 1) >> RAM_PAGE_SHIFT] = 1;
+#if RAM_PACKED
+    uint64_t word;
+    int shift = (address & 1) * 4;
+    uint8_t *p = &ram[address / 2];
+    uint64_t mask = nib_mask(n) << shift;
+    memcpy(&word, p, sizeof(word));
+    word = (word & ~mask) | ((value << shift) & mask);
+    memcpy(p, &word, sizeof(word));
+    if (shift && (n == 16))
+        p[8] = (p[8] & 0xf0) | (value >> 60);
+#else
+    for (int i = 0; i < n; i++) {
+        ram[address + i] = value & 0xf;
+        value >>= 4;
+    }
+#endif
+}
+
+// Copy n nibbles within RAM, with memmove semantics
+void ram_move(size_t dst, size_t src, size_t n) {
+    memset(&ram_dirty[dst >> RAM_PAGE_SHIFT], 1,
+            ((dst + n - 1) >> RAM_PAGE_SHIFT) - (dst >> RAM_PAGE_SHIFT) + 1);
+#if RAM_PACKED
+    // 16 nibbles at a time, in the direction that reads each chunk before
+    // it is overwritten
+    if (dst <= src) {
+        for (size_t i = 0; i < n; i += 16) {
+            int k = (n - i < 16) ? n - i : 16;
+            ram_store(dst + i, ram_load(src + i, k), k);
+        }
+    }
+    else {
+        for (size_t i = n; i > 0;) {
+            int k = (i < 16) ? i : 16;
+            i -= k;
+            ram_store(dst + i, ram_load(src + i, k), k);
+        }
+    }
+#else
+    memmove(&ram[dst], &ram[src], n);
+#endif
 }
@@ -22,5 +22,16 @@
 //
 #pragma once
 
+#define RAM_PAGE_SHIFT  (8)
+#define RAM_PAGES       (RAM_NIBBLES >> RAM_PAGE_SHIFT)
+
+// Pages written since their flag was last cleared, see rewind.c
+extern uint8_t ram_dirty[RAM_PAGES];
+
 void ram_init();
 uint8_t *ram_get_ptr(size_t address);
+void ram_write(size_t address, uint8_t value);
+uint8_t ram_read(size_t address);
+uint64_t ram_load(size_t address, int n);
+void ram_store(size_t address, uint64_t value, int n);
+void ram_move(size_t dst, size_t src, size_t n);
@@ -0,0 +1,277 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "util.h"
+#include "memory.h"
+#include "ram.h"
+#include "io.h"
+#include "cpu.h"
+#include "sample.h"
+#include "rewind.h"
+
+// Rewind buffer. The shadow copy holds RAM as of the latest checkpoint and
+// acts as keyframe. Every interval cycles a checkpoint stores the CPU, I/O
+// and bus state, plus the XOR between each page written since the previous
+// checkpoint and its shadow copy, run length coded. XOR deltas work both
+// ways, so going back applies them to RAM from the newest checkpoint down.
+//
+// Checkpoints live in a fixed size byte ring, the oldest ones are dropped to
+// make room. Pages are coded as 16 nibble words: a token byte with bit 7 set
+// is a run of (token & 0x7f) + 1 zero words, otherwise token + 1 words
+// follow as they are.
+
+#define PAGE_WORDS  ((1 << RAM_PAGE_SHIFT) / 16)
+#define RAM_WORDS   (RAM_NIBBLES / 16)
+
+typedef struct {
+    uint32_t size;          // Bytes taken in the ring, this header included
+    uint32_t pages;         // Number of page deltas following
+    CPU_STATE cpu;
+    MODULE modules[MEM_COUNT];
+    IO_STATE io;
+} FRAME;
+
+// Each page delta is a uint16_t page number and byte length, then the data
+#define PAGE_MAX    (4 + PAGE_WORDS * 9)
+
+uint64_t rewind_next = UINT64_MAX;
+static uint64_t interval;
+static uint64_t *shadow;
+static uint8_t *scratch;
+static uint8_t *ring;
+static size_t ring_size;
+static size_t ring_head;    // Where the next checkpoint goes
+static uint32_t *frame_off; // Ring offset of each checkpoint, oldest first
+static int frame_alloc;
+static int frame_first;
+static int frame_count;
+
+static FRAME *get_frame(int i) {
+    return (FRAME *)&ring[frame_off[(frame_first + i) % frame_alloc]];
+}
+
+static uint32_t oldest_offset() {
+    return frame_off[frame_first];
+}
+
+static void drop_oldest() {
+    frame_first = (frame_first + 1) % frame_alloc;
+    frame_count--;
+}
+
+static size_t encode(const uint64_t *delta, uint8_t *out) {
+    uint8_t *p = out;
+    for (int i = 0; i < PAGE_WORDS;) {
+        int n = 0;
+        if (!delta[i]) {
+            while ((i + n < PAGE_WORDS) && !delta[i + n])
+                n++;
+            *p++ = 0x80 | (n - 1);
+        }
+        else {
+            while ((i + n < PAGE_WORDS) && delta[i + n])
+                n++;
+            *p++ = n - 1;
+            memcpy(p, &delta[i], n * sizeof(uint64_t));
+            p += n * sizeof(uint64_t);
+        }
+        i += n;
+    }
+    return p - out;
+}
+
+static void decode(const uint8_t *in, size_t size, uint64_t *delta) {
+    const uint8_t *end = in + size;
+    int i = 0;
+    while ((in < end) && (i < PAGE_WORDS)) {
+        int n = (*in & 0x7f) + 1;
+        if (i + n > PAGE_WORDS)
+            n = PAGE_WORDS - i;
+        if (*in++ & 0x80) {
+            memset(&delta[i], 0, n * sizeof(uint64_t));
+        }
+        else {
+            memcpy(&delta[i], in, n * sizeof(uint64_t));
+            in += n * sizeof(uint64_t);
+        }
+        i += n;
+    }
+}
+
+// Copy the shadow copy of a page back to RAM
+static void store_page(int page) {
+    for (int i = 0; i < PAGE_WORDS; i++) {
+        int w = page * PAGE_WORDS + i;
+        ram_store(w * 16, shadow[w], 16);
+    }
+}
+
+// Allocate size bytes for a new checkpoint, dropping old ones as needed
+static uint8_t *ring_alloc(size_t size) {
+    size_t pos = ring_head;
+    if (frame_count == frame_alloc)
+        drop_oldest();
+    if (pos + size > ring_size) {
+        while (frame_count && (oldest_offset() >= pos))
+            drop_oldest();
+        pos = 0;
+    }
+    while (frame_count && (oldest_offset() >= pos) &&
+            (oldest_offset() < pos + size))
+        drop_oldest();
+    frame_off[(frame_first + frame_count) % frame_alloc] = pos;
+    frame_count++;
+    ring_head = pos + size;
+    return &ring[pos];
+}
+
+// Keep checkpoints every interval cycles in a ring of size bytes. The first
+// checkpoint is the current state.
+bool rewind_open(size_t size, uint64_t cycles) {
+    rewind_close();
+    // A checkpoint with every page changed must fit
+    size = (size + 7) & ~(size_t)7;
+    if (size < sizeof(FRAME) + RAM_PAGES * PAGE_MAX)
+        return false;
+    ring = malloc(size);
+    shadow = malloc(RAM_WORDS * sizeof(uint64_t));
+    scratch = malloc(sizeof(FRAME) + RAM_PAGES * PAGE_MAX);
+    frame_alloc = size / sizeof(FRAME) + 1;
+    frame_off = malloc(frame_alloc * sizeof(uint32_t));
+    if (!ring || !shadow || !scratch || !frame_off)
+        fatal("Unable to allocate rewind buffer\n");
+    ring_size = size;
+    interval = cycles;
+    for (int i = 0; i < RAM_WORDS; i++)
+        shadow[i] = ram_load(i * 16, 16);
+    memset(ram_dirty, 0, RAM_PAGES);
+    rewind_capture();
+    return true;
+}
+
+void rewind_close() {
+    free(ring);
+    free(shadow);
+    free(scratch);
+    free(frame_off);
+    ring = NULL;
+    shadow = NULL;
+    scratch = NULL;
+    frame_off = NULL;
+    ring_head = 0;
+    frame_first = 0;
+    frame_count = 0;
+    rewind_next = UINT64_MAX;
+}
+
+// Store a checkpoint of the current state
+void rewind_capture() {
+    uint8_t *p = scratch + sizeof(FRAME);
+    uint32_t pages = 0;
+    for (int page = 0; page < RAM_PAGES; page++) {
+        if (!ram_dirty[page])
+            continue;
+        ram_dirty[page] = 0;
+        uint64_t delta[PAGE_WORDS];
+        bool changed = false;
+        for (int i = 0; i < PAGE_WORDS; i++) {
+            int w = page * PAGE_WORDS + i;
+            uint64_t v = ram_load(w * 16, 16);
+            delta[i] = v ^ shadow[w];
+            shadow[w] = v;
+            changed |= (delta[i] != 0);
+        }
+        if (!changed)
+            continue;
+        uint16_t header[2] = { page, encode(delta, p + 4) };
+        memcpy(p, header, sizeof(header));
+        p += 4 + header[1];
+        pages++;
+    }
+
+    FRAME *f = (FRAME *)scratch;
+    f->size = ((p - scratch) + 7) & ~(size_t)7;
+    f->pages = pages;
+    f->cpu = cpu;
+    memory_save(f->modules);
+    io_save(&f->io);
+    memcpy(ring_alloc(f->size), scratch, f->size);
+    rewind_next = cpu.cycles + interval;
+}
+
+// Go back to the newest checkpoint taken at or before cycles, later ones are
+// dropped. Run forward from there to reach cycles exactly. Returns false if
+// that point is no longer in the buffer.
+bool rewind_to(uint64_t cycles) {
+    int target = frame_count - 1;
+    while ((target >= 0) && (get_frame(target)->cpu.cycles > cycles))
+        target--;
+    if (target < 0)
+        return false;
+
+    // Undo writes since the latest checkpoint
+    for (int page = 0; page < RAM_PAGES; page++)
+        if (ram_dirty[page])
+            store_page(page);
+    // Then each checkpoint down to the target
+    while (frame_count - 1 > target) {
+        FRAME *f = get_frame(frame_count - 1);
+        const uint8_t *p = (const uint8_t *)(f + 1);
+        for (uint32_t i = 0; i < f->pages; i++) {
+            uint16_t header[2];
+            uint64_t delta[PAGE_WORDS];
+            memcpy(header, p, sizeof(header));
+            decode(p + 4, header[1], delta);
+            for (int j = 0; j < PAGE_WORDS; j++)
+                shadow[header[0] * PAGE_WORDS + j] ^= delta[j];
+            store_page(header[0]);
+            p += 4 + header[1];
+        }
+        ring_head = (uint8_t *)f - ring;
+        frame_count--;
+    }
+
+    FRAME *f = get_frame(target);
+    ring_head = ((uint8_t *)f - ring) + f->size;
+    cpu = f->cpu;
+    io_restore(&f->io);
+    memory_restore(f->modules);
+    memset(ram_dirty, 0, RAM_PAGES);
+    rewind_next = cpu.cycles + interval;
+    sample_resync();
+    return true;
+}
+
+// Number of checkpoints, bytes used and cycle count of the oldest one
+void rewind_stats(int *frames, size_t *bytes, uint64_t *oldest) {
+    *frames = frame_count;
+    *bytes = 0;
+    *oldest = frame_count ? get_frame(0)->cpu.cycles : 0;
+    for (int i = 0; i < frame_count; i++)
+        *bytes += get_frame(i)->size;
+}
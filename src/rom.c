@@ -29,7 +29,12 @@
 
 uint8_t *rom;
 
-void rom_init(uint8_t *rom_ptr) {
+// The image holds one nibble per byte and has to cover the whole address
+// space, which is read as is by rom_read() and rom_hash()
+void rom_init(uint8_t *rom_ptr, size_t size) {
+    if (size < ADDR_MASK + 1)
+        fatal("ROM image is %zu bytes, expected %d, one byte per nibble\n",
+                size, ADDR_MASK + 1);
     rom = rom_ptr;
 }
 
@@ -54,3 +59,14 @@ uint8_t rom_read(size_t address) {
 #endif
     return nibble;
 }
+
+// FNV-1a hash of the ROM nibbles visible on the bus, identifies the ROM
+// version for files derived from it
+uint64_t rom_hash() {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i <= ADDR_MASK; i++) {
+        h ^= rom_read(i);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
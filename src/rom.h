@@ -22,7 +22,8 @@
 //
 #pragma once
 
-void rom_init(uint8_t *rom_ptr);
+void rom_init(uint8_t *rom_ptr, size_t size);
 uint8_t *rom_get_ptr(size_t address);
 void rom_write(size_t address, uint8_t value);
 uint8_t rom_read(size_t address);
+uint64_t rom_hash();
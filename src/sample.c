@@ -0,0 +1,209 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "util.h"
+#include "cpu.h"
+#include "sample.h"
+
+// Call stack sampling profiler. Every interval cycles the return stack and
+// PC are taken as one stack, and identical stacks are counted together in
+// an open addressing hash table. The result is written in the folded format
+// read by flame graph tools: frames from the oldest return address to the
+// PC, separated by ';', then the count. The return stack only holds 8
+// levels, so deeper stacks lose their outermost callers.
+//
+// Frames are named after the closest symbol at or below their address when
+// a symbol file is loaded, with lines of "<hex address> <name>".
+
+#define TABLE_SIZE      (1 << 16) // Distinct stacks, a power of 2
+
+typedef struct {
+    uint32_t frame[RSTK_DEPTH + 1]; // Oldest first, the PC last
+    int depth;          // Number of frames, 0 for a free entry
+    uint64_t count;
+} STACK;
+
+typedef struct {
+    uint32_t address;
+    char *name;
+} SYMBOL;
+
+uint64_t sample_next = UINT64_MAX;
+static uint64_t interval;
+static STACK *table;
+static int stack_count;
+static uint64_t dropped;    // Samples lost with the table full
+static SYMBOL *symbols;
+static int symbol_count;
+
+// Start sampling every cycles cycles
+bool sample_open(uint64_t cycles) {
+    if (!cycles)
+        return false;
+    table = calloc(TABLE_SIZE, sizeof(STACK));
+    if (!table)
+        return false;
+    interval = cycles;
+    stack_count = 0;
+    dropped = 0;
+    sample_next = cpu.cycles + interval;
+    return true;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    uint32_t x = ((const SYMBOL *)a)->address;
+    uint32_t y = ((const SYMBOL *)b)->address;
+    return (x > y) - (x < y);
+}
+
+// Load names for frames from fn, returns the number of symbols or -1 if the
+// file can not be read
+int sample_symbols(const char *fn) {
+    FILE *fp = fopen(fn, "r");
+    if (!fp)
+        return -1;
+    char line[256];
+    int alloc = 0;
+    for (int n = 1; fgets(line, sizeof(line), fp); n++) {
+        unsigned int address;
+        char name[128];
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if (sscanf(line, "%x %127s", &address, name) != 2) {
+            fprintf(stderr, "%s:%d: invalid symbol\n", fn, n);
+            continue;
+        }
+        if (symbol_count == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            symbols = realloc(symbols, alloc * sizeof(SYMBOL));
+            if (!symbols)
+                fatal("Unable to allocate symbols\n");
+        }
+        symbols[symbol_count].address = address & ADDR_MASK;
+        symbols[symbol_count].name = strdup(name);
+        symbol_count++;
+    }
+    fclose(fp);
+    qsort(symbols, symbol_count, sizeof(SYMBOL), compare_symbols);
+    return symbol_count;
+}
+
+static uint32_t hash_stack(const uint32_t *frame, int depth) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash ^= frame[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void sample_capture() {
+    uint32_t frame[RSTK_DEPTH + 1];
+    int depth = cpu.rstk_count;
+    memcpy(frame, cpu.rstk, depth * sizeof(uint32_t));
+    frame[depth++] = cpu.pc;
+    sample_next = cpu.cycles + interval;
+
+    uint32_t i = hash_stack(frame, depth) & (TABLE_SIZE - 1);
+    for (;;) {
+        STACK *s = &table[i];
+        if (!s->depth) {
+            // Keep the table at most 3/4 full so probes stay short
+            if (stack_count >= TABLE_SIZE / 4 * 3) {
+                dropped++;
+                return;
+            }
+            memcpy(s->frame, frame, depth * sizeof(uint32_t));
+            s->depth = depth;
+            stack_count++;
+        }
+        if ((s->depth == depth) &&
+                !memcmp(s->frame, frame, depth * sizeof(uint32_t))) {
+            s->count++;
+            return;
+        }
+        i = (i + 1) & (TABLE_SIZE - 1);
+    }
+}
+
+// Schedule the next sample from the current cycle count, after it jumped back
+void sample_resync() {
+    if (table)
+        sample_next = cpu.cycles + interval;
+}
+
+static void write_frame(FILE *fp, uint32_t address) {
+    int lo = 0, hi = symbol_count - 1;
+    const SYMBOL *found = NULL;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols[mid].address <= address) {
+            found = &symbols[mid];
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    if (found)
+        fputs(found->name, fp);
+    else
+        fprintf(fp, "%05x", address);
+}
+
+bool sample_write(const char *fn) {
+    FILE *fp = fopen(fn, "w");
+    if (!fp)
+        return false;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        const STACK *s = &table[i];
+        if (!s->depth)
+            continue;
+        for (int j = 0; j < s->depth; j++) {
+            if (j)
+                fputc(';', fp);
+            write_frame(fp, s->frame[j]);
+        }
+        fprintf(fp, " %llu\n", (unsigned long long)s->count);
+    }
+    if (dropped)
+        fprintf(stderr, "Warning: %llu samples dropped, too many stacks\n",
+                (unsigned long long)dropped);
+    return !fclose(fp);
+}
+
+void sample_close() {
+    sample_next = UINT64_MAX;
+    free(table);
+    table = NULL;
+    for (int i = 0; i < symbol_count; i++)
+        free(symbols[i].name);
+    free(symbols);
+    symbols = NULL;
+    symbol_count = 0;
+}
@@ -0,0 +1,331 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "memory.h"
+#include "io.h"
+#include "hle.h"
+#include "cpu.h"
+#include "emu.h"
+#include "object.h"
+
+// Batch evaluation service. The machine is booted once, then a pool of
+// forked instances wait for connections on a Unix socket. Each instance
+// serves a single request and exits, and a new one is forked from the
+// booted state in its place. Memory is shared copy-on-write, so every
+// request starts from the same state without copying it.
+//
+// A request is a list of command lines, ended by an empty line or by
+// closing the write side. Every command gets one line back, "ok" with its
+// results or "error" with a reason:
+//
+//   poke <hex address> <hex nibbles>   Write nibbles, lowest address first
+//   key <out> <in> [<hold>]            Press a key, run hold cycles, release
+//   run [<cycles>]                     Run until idle or the cycle limit,
+//                                      gives cycles, insns, pc and idle
+//   peek <hex address> <count>         Read count nibbles
+//   object <hex nibbles>               Push an object on the stack, gives
+//                                      its address
+//   level <n>                          Read the object at stack level n,
+//                                      gives its address and nibbles
+
+#define MAX_PEEK        (65536)
+
+static uint64_t max_cycles = 100000000;
+
+static int hex_digit(char c) {
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Number of hex digits making up the whole of data, or 0
+static int hex_length(const char *data) {
+    int n = 0;
+    while (hex_digit(data[n]) >= 0)
+        n++;
+    return data[n] ? 0 : n;
+}
+
+static void write_hex(FILE *out, const uint8_t *data, int n) {
+    for (int i = 0; i < n; i++)
+        fputc("0123456789abcdef"[data[i]], out);
+}
+
+static void cmd_poke(FILE *out, const char *args) {
+    unsigned int address;
+    int pos;
+    if (sscanf(args, "%x %n", &address, &pos) != 1) {
+        fprintf(out, "error expected <hex address> <hex nibbles>\n");
+        return;
+    }
+    const char *data = args + pos;
+    int n = hex_length(data);
+    if (!n) {
+        fprintf(out, "error invalid nibbles\n");
+        return;
+    }
+    for (int i = 0; i < n; i++)
+        memory_write_nibble(address + i, hex_digit(data[i]));
+    fprintf(out, "ok\n");
+}
+
+static void cmd_object(FILE *out, const char *args) {
+    int n = hex_length(args);
+    if (!n || (n > OBJECT_MAX)) {
+        fprintf(out, "error invalid nibbles\n");
+        return;
+    }
+    uint8_t *obj = malloc(n);
+    assert(obj);
+    for (int i = 0; i < n; i++)
+        obj[i] = hex_digit(args[i]);
+    uint32_t address;
+    if (object_size(obj, n) != n)
+        fprintf(out, "error not a single object\n");
+    else if (!object_push(obj, n, &address))
+        fprintf(out, "error no room for the object\n");
+    else
+        fprintf(out, "ok %05x\n", address);
+    free(obj);
+}
+
+static void cmd_level(FILE *out, const char *args) {
+    int level;
+    uint8_t *obj;
+    uint32_t address;
+    if (sscanf(args, "%d", &level) != 1) {
+        fprintf(out, "error expected <n>\n");
+        return;
+    }
+    int size = object_read(level, &obj, &address);
+    if (size < 0) {
+        fprintf(out, "error no object at level %d\n", level);
+        return;
+    }
+    fprintf(out, "ok %05x ", address);
+    write_hex(out, obj, size);
+    fputc('\n', out);
+    free(obj);
+}
+
+static void cmd_key(FILE *out, const char *args) {
+    int key_out, key_in;
+    unsigned long long hold = 20000;
+    if (sscanf(args, "%d %d %llu", &key_out, &key_in, &hold) < 2) {
+        fprintf(out, "error expected <out> <in> [<hold>]\n");
+        return;
+    }
+    io_key(key_out, key_in, true);
+    emu_run((hold < max_cycles) ? hold : max_cycles);
+    io_key(key_out, key_in, false);
+    fprintf(out, "ok\n");
+}
+
+static void cmd_run(FILE *out, const char *args) {
+    unsigned long long cycles;
+    if ((sscanf(args, "%llu", &cycles) != 1) || (cycles > max_cycles))
+        cycles = max_cycles;
+    uint64_t start = cpu.cycles;
+    uint64_t insns = cpu.insns;
+    emu_run(cycles);
+    fprintf(out, "ok cycles=%llu insns=%llu pc=%05x idle=%d\n",
+            (unsigned long long)(cpu.cycles - start),
+            (unsigned long long)(cpu.insns - insns), cpu.pc,
+            cpu.shutdown && !cpu.int_pending);
+}
+
+static void cmd_peek(FILE *out, const char *args) {
+    unsigned int address;
+    int count;
+    if ((sscanf(args, "%x %d", &address, &count) != 2) || (count < 1) ||
+            (count > MAX_PEEK)) {
+        fprintf(out, "error expected <hex address> <count>\n");
+        return;
+    }
+    uint8_t data[MAX_PEEK];
+    for (int i = 0; i < count; i++)
+        data[i] = memory_read_nibble(address + i);
+    fprintf(out, "ok ");
+    write_hex(out, data, count);
+    fputc('\n', out);
+}
+
+static void serve(int fd) {
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if (!in || !out)
+        return;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, in)) > 0) {
+        char name[16];
+        int pos;
+        // Lines may end with CR LF, as sent by nc -C
+        while ((len > 0) &&
+                ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+            line[--len] = '\0';
+        if (!line[0])
+            break;
+        if (sscanf(line, "%15s %n", name, &pos) != 1)
+            continue;
+        const char *args = line + pos;
+        if (!strcmp(name, "poke"))
+            cmd_poke(out, args);
+        else if (!strcmp(name, "key"))
+            cmd_key(out, args);
+        else if (!strcmp(name, "run"))
+            cmd_run(out, args);
+        else if (!strcmp(name, "peek"))
+            cmd_peek(out, args);
+        else if (!strcmp(name, "object"))
+            cmd_object(out, args);
+        else if (!strcmp(name, "level"))
+            cmd_level(out, args);
+        else
+            fprintf(out, "error unknown command %s\n", name);
+    }
+    free(line);
+    fclose(out);
+    fclose(in);
+}
+
+// Fork an instance that serves one connection
+static pid_t spawn(int listen_fd) {
+    pid_t pid = fork();
+    if (pid)
+        return pid;
+    // Do not outlive the service
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1)
+        _exit(0);
+    int fd;
+    do {
+        fd = accept(listen_fd, NULL, NULL);
+    } while ((fd < 0) && (errno == EINTR));
+    if (fd >= 0)
+        serve(fd);
+    _exit(0);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -r <file>    ROM file (default ROM.48G)\n"
+            "  -u <path>    Socket path (default satrec.sock)\n"
+            "  -n <count>   Number of instances in the pool (default 4)\n"
+            "  -b <cycles>  Cycles to run while booting (default 100000000)\n"
+            "  -m <cycles>  Cycle limit for each command (default 100000000)\n"
+            "  -H <file>    HLE hooks file (default <rom>.hle)\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *rom_file = "ROM.48G";
+    const char *socket_path = "satrec.sock";
+    const char *hle_file = NULL;
+    int pool_size = 4;
+    uint64_t boot_cycles = 100000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:u:n:b:m:H:")) != -1) {
+        switch (opt) {
+        case 'r': rom_file = optarg; break;
+        case 'u': socket_path = optarg; break;
+        case 'n': pool_size = atoi(optarg); break;
+        case 'b': boot_cycles = strtoull(optarg, NULL, 0); break;
+        case 'm': max_cycles = strtoull(optarg, NULL, 0); break;
+        case 'H': hle_file = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (pool_size < 1)
+        usage(argv[0]);
+
+    size_t rom_size;
+    uint8_t *rom = load_file(rom_file, &rom_size);
+    rom_init(rom, rom_size);
+    emu_init();
+    char default_hle[1024];
+    if (!hle_file) {
+        snprintf(default_hle, sizeof(default_hle), "%s.hle", rom_file);
+        hle_load(default_hle);
+    }
+    else if (hle_load(hle_file) < 0) {
+        fatal("Unable to open %s\n", hle_file);
+    }
+
+    // Instances start from here, with the blocks translated while booting
+    emu_run(boot_cycles);
+    printf("Booted to PC %05x after %llu cycles\n", cpu.pc,
+            (unsigned long long)cpu.cycles);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        fatal("Socket path %s is too long\n", socket_path);
+    strcpy(addr.sun_path, socket_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if ((listen_fd < 0) ||
+            bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(listen_fd, 128))
+        fatal("Unable to listen on %s\n", socket_path);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on %s with %d instances\n", socket_path, pool_size);
+    fflush(stdout);
+    // Replace every instance that is done
+    int running = 0;
+    for (;;) {
+        while (running < pool_size) {
+            if (spawn(listen_fd) < 0) {
+                sleep(1);
+                break;
+            }
+            running++;
+        }
+        if (wait(NULL) > 0)
+            running--;
+    }
+    return 0;
+}
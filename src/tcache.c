@@ -0,0 +1,346 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "disasm.h"
+#include "memory.h"
+#include "translate.h"
+#include "idiom.h"
+#include "tcache.h"
+
+// Persistent cache of translated ROM blocks. The file is mapped read-only at
+// start and blocks are looked up by binary search only when the block map
+// misses. Uops hold no pointers, so records are used as is and only the
+// dispatch slots are rebuilt. Blocks translated during the run are kept on
+// the side and merged into a new file by tcache_save().
+//
+// File layout: TCACHE_HEADER, count TCACHE_INDEX entries sorted by PC, then
+// the records they point to. Everything is 8-byte aligned.
+
+#define TCACHE_MAGIC    "STC2"
+
+// Translator options that change the uops of cached blocks
+#define TCACHE_OPT_IDIOM    (1u << 0)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;   // TRANSLATE_VERSION
+    uint64_t rom_hash;
+    uint32_t uop_size;  // sizeof(UOP), guards against layout changes
+    uint32_t count;
+    uint32_t options;   // TCACHE_OPT_* the blocks were translated with
+    uint32_t reserved;
+} TCACHE_HEADER;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t offset;    // Record offset from the start of the file
+} TCACHE_INDEX;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t end;
+    uint8_t count;
+    uint8_t carry_elided;
+    uint8_t dead_elided;
+    uint8_t reserved;
+    uint32_t reserved2;
+    UOP uop[];
+} TCACHE_RECORD;
+
+static char *cache_fn;
+static uint64_t cache_rom_hash;
+static const uint8_t *map;
+static size_t map_size;
+static const TCACHE_INDEX *map_index;
+static uint32_t map_count;
+// Blocks translated since the cache was opened
+static TCACHE_RECORD **added;
+static int added_count;
+static int added_alloc;
+static int hit_count;
+
+static uint32_t translate_options() {
+    return idiom_enable ? TCACHE_OPT_IDIOM : 0;
+}
+
+static size_t record_size(int count) {
+    return sizeof(TCACHE_RECORD) + count * sizeof(UOP);
+}
+
+// Whether the uop only indexes registers and tables within bounds, so a
+// corrupt file can not make the handlers reach outside them
+static bool valid_uop(const UOP *u, int index, int count) {
+    if ((u->op >= UOP_TYPE_COUNT) || (u->field >= F_COUNT) ||
+            (u->pc > ADDR_MASK) || (u->target > ADDR_MASK))
+        return false;
+    switch (u->op) {
+    case UOP_LOOP:
+        return (index == 0) && (u->src == count - 1);
+    case UOP_DSET:
+        return u->dst < 2;
+    case UOP_LHEX:
+        return (u->dst <= R_D) && (u->src <= 16);
+    case UOP_LOAD:
+        return (u->src < 2) && (u->dst <= R_D);
+    case UOP_STORE:
+    case UOP_DADD:
+    case UOP_DSUB:
+    case UOP_DCOPY:
+    case UOP_DEXCH:
+        return (u->dst < 2) && (u->src <= R_D);
+    case UOP_RSTO:
+    case UOP_RLOD:
+    case UOP_REXC:
+        return (u->imm < 5) && (u->dst <= R_D) && (u->src <= R_D);
+    default:
+        return (u->dst <= R_D) && (u->src <= R_D);
+    }
+}
+
+static const TCACHE_RECORD *find(uint32_t pc) {
+    uint32_t lo = 0, hi = map_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (map_index[mid].pc < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if ((lo == map_count) || (map_index[lo].pc != pc))
+        return NULL;
+    uint32_t offset = map_index[lo].offset;
+    if ((offset + sizeof(TCACHE_RECORD) > map_size) || (offset & 7))
+        return NULL;
+    const TCACHE_RECORD *r = (const TCACHE_RECORD *)(map + offset);
+    if ((r->count == 0) || (r->count > BLOCK_MAX_UOPS) ||
+            (offset + record_size(r->count) > map_size))
+        return NULL;
+    return r;
+}
+
+// Check every record of the mapped file
+static bool valid_map() {
+    for (uint32_t i = 0; i < map_count; i++) {
+        const TCACHE_RECORD *r = find(map_index[i].pc);
+        if (!r || (r->pc != map_index[i].pc) || (r->end > ADDR_MASK + 1))
+            return false;
+        for (int j = 0; j < r->count; j++)
+            if (!valid_uop(&r->uop[j], j, r->count))
+                return false;
+    }
+    return true;
+}
+
+// Open the cache file fn for the current ROM. A missing or stale file, or
+// one made with other translator options, only means starting empty, it is
+// replaced by tcache_save().
+bool tcache_open(const char *fn) {
+    tcache_close();
+    cache_fn = strdup(fn);
+    cache_rom_hash = rom_hash();
+
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(TCACHE_HEADER))) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    const TCACHE_HEADER *header = p;
+    if (memcmp(header->magic, TCACHE_MAGIC, 4) ||
+            (header->version != TRANSLATE_VERSION) ||
+            (header->rom_hash != cache_rom_hash) ||
+            (header->uop_size != sizeof(UOP)) ||
+            (header->options != translate_options()) ||
+            (sizeof(TCACHE_HEADER) + (size_t)header->count *
+                    sizeof(TCACHE_INDEX) > (size_t)st.st_size)) {
+        munmap(p, st.st_size);
+        return false;
+    }
+    map = p;
+    map_size = st.st_size;
+    map_index = (const TCACHE_INDEX *)(map + sizeof(TCACHE_HEADER));
+    map_count = header->count;
+    // A damaged file is dropped as a whole
+    if (!valid_map()) {
+        munmap(p, st.st_size);
+        map = NULL;
+        map_count = 0;
+        return false;
+    }
+    return true;
+}
+
+// A translated block only depends on ROM contents as long as the block
+// itself and the successors inspected by liveness analysis are in ROM.
+// Successors that were not in ROM made the analysis conservative, so a
+// block stays correct if they have been mapped to ROM since.
+static bool in_rom(const BLOCK *block) {
+    const UOP *last = &block->uop[block->count - 1];
+    return (memory_map(block->pc) == MEM_ROM) &&
+            (memory_map((block->end - 1) & ADDR_MASK) == MEM_ROM) &&
+            (memory_map(block->end & ADDR_MASK) == MEM_ROM) &&
+            (memory_map(last->target & ADDR_MASK) == MEM_ROM);
+}
+
+// Fill block from the cache, the caller still has to prepare it
+bool tcache_load(BLOCK *block, uint32_t pc) {
+    if (!map || (memory_map(pc) != MEM_ROM))
+        return false;
+    const TCACHE_RECORD *r = find(pc);
+    if (!r)
+        return false;
+    block->pc = r->pc;
+    block->end = r->end;
+    block->count = r->count;
+    block->carry_elided = r->carry_elided;
+    block->dead_elided = r->dead_elided;
+    memcpy(block->uop, r->uop, r->count * sizeof(UOP));
+    if (!in_rom(block))
+        return false;
+    hit_count++;
+    return true;
+}
+
+// Remember a newly translated block, blocks outside ROM are never cached
+void tcache_add(const BLOCK *block) {
+    if (!cache_fn || !in_rom(block))
+        return;
+    if (added_count == added_alloc) {
+        added_alloc = added_alloc ? added_alloc * 2 : 1024;
+        added = realloc(added, added_alloc * sizeof(TCACHE_RECORD *));
+        if (!added)
+            fatal("Unable to allocate translation cache\n");
+    }
+    TCACHE_RECORD *r = calloc(1, record_size(block->count));
+    if (!r)
+        fatal("Unable to allocate translation cache\n");
+    r->pc = block->pc;
+    r->end = block->end;
+    r->count = block->count;
+    r->carry_elided = block->carry_elided;
+    r->dead_elided = block->dead_elided;
+    memcpy(r->uop, block->uop, block->count * sizeof(UOP));
+    added[added_count++] = r;
+}
+
+static int compare_records(const void *a, const void *b) {
+    uint32_t pa = (*(const TCACHE_RECORD **)a)->pc;
+    uint32_t pb = (*(const TCACHE_RECORD **)b)->pc;
+    return (pa > pb) - (pa < pb);
+}
+
+// Write the mapped blocks and the added ones to a new file, replacing the
+// old one atomically so concurrent runs never see a partial cache
+bool tcache_save() {
+    if (!cache_fn || !added_count)
+        return true;
+
+    // Newer translations win over mapped records for the same address
+    uint8_t *seen = calloc(ADDR_MASK + 1, 1);
+    const TCACHE_RECORD **list =
+            malloc((added_count + map_count) * sizeof(TCACHE_RECORD *));
+    if (!seen || !list)
+        fatal("Unable to allocate translation cache\n");
+    uint32_t count = 0;
+    for (int i = 0; i < added_count; i++) {
+        if (!seen[added[i]->pc]) {
+            seen[added[i]->pc] = 1;
+            list[count++] = added[i];
+        }
+    }
+    for (uint32_t i = 0; i < map_count; i++) {
+        const TCACHE_RECORD *r = find(map_index[i].pc);
+        if (r && !seen[r->pc]) {
+            seen[r->pc] = 1;
+            list[count++] = r;
+        }
+    }
+    qsort(list, count, sizeof(TCACHE_RECORD *), compare_records);
+
+    // Each run writes its own temporary file next to the cache
+    char tmp_fn[TEMP_NAME_MAX];
+    FILE *fp = temp_create(cache_fn, tmp_fn);
+    bool ok = (fp != NULL);
+    if (ok) {
+        TCACHE_HEADER header = {
+            .magic = TCACHE_MAGIC,
+            .version = TRANSLATE_VERSION,
+            .rom_hash = cache_rom_hash,
+            .uop_size = sizeof(UOP),
+            .count = count,
+            .options = translate_options()
+        };
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        uint32_t offset = sizeof(header) + count * sizeof(TCACHE_INDEX);
+        for (uint32_t i = 0; ok && (i < count); i++) {
+            TCACHE_INDEX index = { list[i]->pc, offset };
+            ok = fwrite(&index, sizeof(index), 1, fp) == 1;
+            offset += record_size(list[i]->count);
+        }
+        for (uint32_t i = 0; ok && (i < count); i++)
+            ok = fwrite(list[i], record_size(list[i]->count), 1, fp) == 1;
+        ok = temp_replace(fp, tmp_fn, cache_fn, ok);
+    }
+
+    free(list);
+    free(seen);
+    return ok;
+}
+
+void tcache_close() {
+    if (map)
+        munmap((void *)map, map_size);
+    map = NULL;
+    map_count = 0;
+    for (int i = 0; i < added_count; i++)
+        free(added[i]);
+    free(added);
+    added = NULL;
+    added_count = added_alloc = 0;
+    free(cache_fn);
+    cache_fn = NULL;
+    hit_count = 0;
+}
+
+void tcache_stats(int *hits, int *new_blocks) {
+    *hits = hit_count;
+    *new_blocks = added_count;
+}
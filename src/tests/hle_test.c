@@ -0,0 +1,257 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "idiom.h"
+#include "hle.h"
+#include "cpu.h"
+#include "emu.h"
+#include "tests/test.h"
+
+// HLE natives against the ROM routines they replace. Each native gets a
+// synthetic routine with the same contract, called with GOSBVL from a stub.
+// Random calls must leave the same machine state with the hooks on and
+// off, and must pass hle_verify.
+//
+// The routines count in A(A), swapped with C(A) and saved on the return
+// stack, move data through C and keep the carry of the caller with two
+// copies of their body.
+
+#define CASES       (200)
+#define RUN_CYCLES  (1000000)
+#define ROUTINES    (0x3000) // Routine n at ROUTINES + n * 0x100
+#define STUBS       (0x100) // GOSBVL to routine n at STUBS + n * 0x10
+
+static const char *names[] = { "copy_up", "copy_down", "clear" };
+
+// Patch the 2 nibble offset of a forward branch emitted at at, relative to
+// the offset itself
+static void patch_branch(TEST_PROG *prog, uint32_t at, uint32_t target) {
+    uint32_t offset = target - (at + 1);
+    prog->rom[at + 1] = offset & 0xf;
+    prog->rom[at + 2] = (offset >> 4) & 0xf;
+}
+
+static void emit_body(TEST_PROG *prog, int native, bool carry) {
+    test_emit(prog, "DE06"); // ACEX A, RSTK=C
+    if (native == 2)
+        test_emit(prog, "D2"); // C=0 A
+    uint32_t skip = prog->pc;
+    test_emit(prog, "8A800"); // ?A=0 A
+    uint32_t loop = prog->pc;
+    // C=DAT0 1 and DAT1=C 1 with D0 and D1 steps, A=A-1 A
+    static const char *loops[] = {
+        "15E015D0160170CC", "1801C015E015D0CC", "15D0170CC"
+    };
+    test_emit(prog, loops[native]);
+    test_branch(prog, "8AC", loop); // ?A#0 A
+    patch_branch(prog, skip + 2, prog->pc);
+    test_emit(prog, "07DE"); // C=RSTK, ACEX A
+    test_emit(prog, carry ? "02" : "03"); // RTNSC or RTNCC
+}
+
+static void build_rom(TEST_PROG *prog) {
+    uint64_t seed = 0x41e00000;
+    test_prog_init(prog);
+    for (int i = 0x1000; i < 0x2000; i++)
+        prog->rom[i] = test_rand(&seed) & 0xf;
+    test_config(prog);
+    // Seed RAM from the random ROM data, 16 nibbles at a time
+    test_d0(prog, 0x1000);
+    test_d1(prog, 0x80000);
+    test_lc(prog, 255);
+    test_emit(prog, "D5");
+    uint32_t seed_loop = prog->pc;
+    test_emit(prog, "1527151716F17FCD");
+    test_branch(prog, "5", seed_loop);
+    test_emit(prog, "807");
+
+    for (int i = 0; i < 3; i++) {
+        prog->pc = STUBS + i * 0x10;
+        test_emit(prog, "8F");
+        test_emit_value(prog, ROUTINES + i * 0x100, 5);
+        test_emit(prog, "807");
+
+        prog->pc = ROUTINES + i * 0x100;
+        uint32_t entry = prog->pc;
+        test_emit(prog, "400"); // GOC
+        emit_body(prog, i, false);
+        patch_branch(prog, entry, prog->pc);
+        emit_body(prog, i, true);
+    }
+}
+
+static bool write_hooks(const char *fn) {
+    FILE *fp = fopen(fn, "w");
+    if (!fp)
+        return false;
+    for (int i = 0; i < 3; i++)
+        fprintf(fp, "%016llx %05x %s\n", (unsigned long long)rom_hash(),
+                ROUTINES + i * 0x100, names[i]);
+    fclose(fp);
+    return true;
+}
+
+static uint64_t hash_memory(uint32_t start, uint32_t end) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint32_t address = start; address < end; address++) {
+        h ^= memory_read_nibble(address);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+typedef struct {
+    CPU_STATE cpu;
+    uint64_t ram;
+} RESULT;
+
+// Random registers for a call to the native, in hex mode as the counts are
+// binary. Blocks stay in RAM from 80000 to 81000.
+static void random_state(CPU_STATE *state, int native, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    for (int i = 0; i < 4; i++)
+        state->reg[i] = ((uint64_t)test_rand(&seed) << 32) | test_rand(&seed);
+    for (int i = 0; i < 5; i++)
+        state->r[i] = ((uint64_t)test_rand(&seed) << 32) | test_rand(&seed);
+    uint32_t k = test_rand(&seed) % 8;
+    uint32_t count = (k == 0) ? 0 : (k == 1) ? 1 : test_rand(&seed) % 0x200;
+    state->reg[R_C] = (state->reg[R_C] & ~(uint64_t)ADDR_MASK) | count;
+    state->d[0] = 0x80200 + test_rand(&seed) % 0xc00;
+    // Often overlapping the source, either way
+    state->d[1] = (test_rand(&seed) & 1) ?
+            state->d[0] + test_rand(&seed) % 0x20 - 0x10 :
+            0x80200 + test_rand(&seed) % 0xc00;
+    if (native == 2)
+        state->d[0] = test_rand(&seed) & ADDR_MASK;
+    state->p = test_rand(&seed) % 16;
+    state->st = test_rand(&seed);
+    state->carry = test_rand(&seed) & 1;
+    state->rstk_count = test_rand(&seed) % 5;
+    for (int i = 0; i < state->rstk_count; i++)
+        state->rstk[i] = test_rand(&seed) & ADDR_MASK;
+}
+
+// Seed RAM, then call the routine from its stub with the given registers
+static void run(int native, const CPU_STATE *state, RESULT *result) {
+    emu_init();
+    emu_run(RUN_CYCLES);
+    CHECK(cpu.shutdown, "RAM seeding did not finish");
+    memcpy(cpu.reg, state->reg, sizeof(cpu.reg));
+    memcpy(cpu.r, state->r, sizeof(cpu.r));
+    cpu.d[0] = state->d[0];
+    cpu.d[1] = state->d[1];
+    cpu.p = state->p;
+    cpu.st = state->st;
+    cpu.carry = state->carry;
+    memcpy(cpu.rstk, state->rstk, sizeof(cpu.rstk));
+    cpu.rstk_count = state->rstk_count;
+    cpu.pc = STUBS + native * 0x10;
+    cpu.shutdown = false;
+    uint64_t start = cpu.cycles;
+    emu_run(RUN_CYCLES);
+    CHECK(cpu.shutdown, "%s did not return", names[native]);
+    result->cpu = cpu;
+    result->cpu.cycles -= start;
+    result->ram = hash_memory(0x80000, 0x81000);
+}
+
+static void compare(int n, const RESULT *a, const RESULT *b) {
+    const CPU_STATE *x = &a->cpu, *y = &b->cpu;
+    bool same = (x->pc == y->pc) && (x->d[0] == y->d[0]) &&
+            (x->d[1] == y->d[1]) && (x->p == y->p) && (x->st == y->st) &&
+            (x->hst == y->hst) && (x->carry == y->carry) &&
+            (x->dec == y->dec) && (x->rstk_count == y->rstk_count) &&
+            !memcmp(x->rstk, y->rstk, x->rstk_count * sizeof(uint32_t)) &&
+            (a->ram == b->ram);
+    for (int i = 0; i < 4; i++)
+        same = same && (x->reg[i] == y->reg[i]);
+    for (int i = 0; i < 5; i++)
+        same = same && (x->r[i] == y->r[i]);
+    CHECK(same, "case %d: %s hooked pc=%05x D0=%05x D1=%05x, "
+            "ROM pc=%05x D0=%05x D1=%05x", n, names[n % 3], x->pc, x->d[0],
+            x->d[1], y->pc, y->d[0], y->d[1]);
+}
+
+static void set_hooks(bool enable) {
+    for (int i = 0; i < 3; i++)
+        hle_set(names[i], enable);
+}
+
+int main() {
+    char fn[64];
+    TEST_PROG prog;
+    build_rom(&prog);
+    rom_init(prog.rom, ROM_SIZE);
+    // Loops in the routines run plain, idioms have their own test
+    idiom_enable = false;
+    snprintf(fn, sizeof(fn), "/tmp/hle_test.%d", (int)getpid());
+    CHECK(write_hooks(fn), "can not write %s", fn);
+    int loaded = hle_load(fn);
+    unlink(fn);
+    CHECK(loaded == 3, "loaded %d hooks, expected 3", loaded);
+
+    static RESULT rom[CASES];
+    static CPU_STATE states[CASES];
+    for (int i = 0; i < CASES; i++) {
+        RESULT with;
+        random_state(&states[i], i % 3, 0x41e10000 + i);
+        set_hooks(false);
+        run(i % 3, &states[i], &rom[i]);
+        set_hooks(true);
+        run(i % 3, &states[i], &with);
+        compare(i, &with, &rom[i]);
+        // The natives take fewer cycles, same cycles means the hook never ran
+        CHECK(with.cpu.cycles < rom[i].cpu.cycles,
+                "case %d: %s took %llu cycles hooked, %llu in ROM", i,
+                names[i % 3], (unsigned long long)with.cpu.cycles,
+                (unsigned long long)rom[i].cpu.cycles);
+    }
+
+    // Verification keeps the result of the ROM routine and disables a hook
+    // that differs, so the hooks must still run afterwards
+    hle_verify = true;
+    for (int i = 0; i < CASES; i++) {
+        RESULT with;
+        run(i % 3, &states[i], &with);
+        compare(i, &with, &rom[i]);
+    }
+    hle_verify = false;
+    for (int i = 0; i < 3; i++) {
+        RESULT with;
+        run(i, &states[i], &with);
+        CHECK(with.cpu.cycles < rom[i].cpu.cycles,
+                "%s was disabled by verification", names[i]);
+    }
+    idiom_enable = true;
+    free(prog.rom);
+    return test_result("hle_test");
+}
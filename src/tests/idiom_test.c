@@ -0,0 +1,248 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "cpu.h"
+#include "emu.h"
+#include "idiom.h"
+#include "tests/test.h"
+
+// Loop idioms against the interpreter. Random programs of fill, copy and
+// scan loops, with pointers in RAM, ROM and running into the I/O registers,
+// must leave the same machine state with idioms on and off.
+
+#define PROGRAMS    (150)
+#define MAX_LOOPS   (8)
+#define RUN_CYCLES  (50000000)
+#define SLICE       (1000)
+#define OVERSHOOT   (5000) // Largest idiom dispatch and a block
+
+static uint32_t random_pointer(uint64_t *seed) {
+    uint32_t k = test_rand(seed) % 10;
+    if (k == 0)
+        return 0x7ef00 + test_rand(seed) % 0x100;
+    if (k < 3)
+        return 0x1000 + test_rand(seed) % 0x800;
+    return 0x80000 + test_rand(seed) % 0x800;
+}
+
+// D0 or D1 increment or decrement by 1 to 16, into an 8 byte op
+static void format_step(char *op, uint64_t *seed, int d) {
+    bool up = (test_rand(seed) % 10) < 7;
+    snprintf(op, 8, "%s%X", up ? (d ? "17" : "16") : (d ? "1C" : "18"),
+            test_rand(seed) % 16);
+}
+
+// Returns the number of loops, their start addresses in loops
+static int build_program(TEST_PROG *prog, uint64_t seed, uint32_t *loops) {
+    char op[8];
+    test_prog_init(prog);
+    for (int i = 0x1000; i < 0x2000; i++)
+        prog->rom[i] = test_rand(&seed) & 0xf;
+    test_config(prog);
+    // Seed RAM from the random ROM data, 16 nibbles at a time
+    test_d0(prog, 0x1000);
+    test_d1(prog, 0x80000);
+    test_lc(prog, 255);
+    test_emit(prog, "D5");
+    uint32_t seed_loop = prog->pc;
+    test_emit(prog, "1527151716F17FCD");
+    test_branch(prog, "5", seed_loop);
+
+    int count = test_rand(&seed) % (MAX_LOOPS - 2) + 3;
+    for (int i = 0; i < count; i++) {
+        // SETHEX or SETDEC, the counters run in either mode
+        test_emit(prog, (test_rand(&seed) % 4) ? "04" : "05");
+        test_d0(prog, random_pointer(&seed));
+        test_d1(prog, random_pointer(&seed));
+        int field = test_rand(&seed) % 8;
+        int kind = test_rand(&seed) % 4;
+        if (kind == 0) {
+            // Scan until C equals A, which is zero
+            test_emit(prog, "AF0");
+            loops[i] = prog->pc;
+            snprintf(op, sizeof(op), "156%X", field);
+            test_emit(prog, op);
+            format_step(op, &seed, 0);
+            test_emit(prog, op);
+            // Stepping the other pointer too is not an idiom
+            if (test_rand(&seed) % 10 < 2) {
+                format_step(op, &seed, 1);
+                test_emit(prog, op);
+            }
+            snprintf(op, sizeof(op), "9%X6", field);
+            test_branch(prog, op, loops[i]);
+            continue;
+        }
+
+        // Counted fill (kind 1) or copy loop, the counter in any working
+        // register and the data in A or C
+        int counter = test_rand(&seed) % 4;
+        bool data_a = (counter == 0) ? false : (counter == 2) ? true :
+                (test_rand(&seed) & 1);
+        test_lc(prog, test_rand(&seed) % 299 + 1);
+        // A=C, B=C or D=C A to move the count into place
+        if (counter != 2)
+            test_emit(prog, (const char *[]){ "DA", "D5", "", "D7" }[counter]);
+        loops[i] = prog->pc;
+        char body[4][8];
+        int n = 0;
+        if (kind != 1)
+            snprintf(body[n++], 8, "%s%X", data_a ? "152" : "156", field);
+        snprintf(body[n++], 8, "%s%X", data_a ? "151" : "155", field);
+        if ((kind != 1) || (test_rand(&seed) % 10 < 2))
+            format_step(body[n++], &seed, 0);
+        format_step(body[n++], &seed, 1);
+        // Sometimes in an order that is not an idiom
+        if (test_rand(&seed) % 10 < 3) {
+            for (int j = n - 1; j > 0; j--) {
+                int k = test_rand(&seed) % (j + 1);
+                char t[8];
+                memcpy(t, body[j], 8);
+                memcpy(body[j], body[k], 8);
+                memcpy(body[k], t, 8);
+            }
+        }
+        for (int j = 0; j < n; j++)
+            test_emit(prog, body[j]);
+        snprintf(op, sizeof(op), "C%X", 0xc + counter);
+        test_emit(prog, op);
+        if (test_rand(&seed) % 10 < 6) {
+            test_branch(prog, "5", loops[i]);
+        }
+        else {
+            // ?A#0 A to ?D#0 A
+            snprintf(op, sizeof(op), "8A%X", 0xc + counter);
+            test_branch(prog, op, loops[i]);
+        }
+    }
+    test_emit(prog, "04807");
+    return count;
+}
+
+static uint64_t hash_memory(uint32_t start, uint32_t end) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint32_t address = start; address < end; address++) {
+        h ^= memory_read_nibble(address);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+typedef struct {
+    CPU_STATE cpu;
+    uint64_t ram;
+    uint64_t io;
+} RESULT;
+
+// Run to the end, in slices of SLICE cycles when sliced is set, which must
+// not overshoot by more than a chunk of iterations
+static void run(const TEST_PROG *prog, bool idiom, bool sliced,
+        RESULT *result) {
+    idiom_enable = idiom;
+    rom_init(prog->rom, ROM_SIZE);
+    emu_init();
+    if (!sliced)
+        emu_run(RUN_CYCLES);
+    while (sliced && !cpu.shutdown && (cpu.cycles < RUN_CYCLES)) {
+        uint64_t end = cpu.cycles + SLICE;
+        emu_run(SLICE);
+        CHECK(cpu.shutdown || (cpu.cycles - end < OVERSHOOT),
+                "ran %llu cycles past a slice at %05x",
+                (unsigned long long)(cpu.cycles - end), cpu.pc);
+    }
+    result->cpu = cpu;
+    result->ram = hash_memory(0x80000, 0x81000);
+    result->io = hash_memory(0x7f000, 0x7f000 + IO_SIZE);
+}
+
+static void compare(int program, const RESULT *a, const RESULT *b) {
+    const CPU_STATE *x = &a->cpu, *y = &b->cpu;
+    bool same = (x->pc == y->pc) && (x->d[0] == y->d[0]) &&
+            (x->d[1] == y->d[1]) && (x->p == y->p) && (x->st == y->st) &&
+            (x->hst == y->hst) && (x->carry == y->carry) &&
+            (x->dec == y->dec) && (x->cycles == y->cycles) &&
+            (x->insns == y->insns) && (a->ram == b->ram) && (a->io == b->io);
+    for (int i = 0; i < 4; i++)
+        same = same && (x->reg[i] == y->reg[i]);
+    CHECK(same, "program %d: idiom pc=%05x cycles=%llu insns=%llu, "
+            "interpreter pc=%05x cycles=%llu insns=%llu", program,
+            x->pc, (unsigned long long)x->cycles,
+            (unsigned long long)x->insns, y->pc,
+            (unsigned long long)y->cycles, (unsigned long long)y->insns);
+}
+
+// A fill of 32K iterations stops for each slice and still ends right
+static void test_long_loop() {
+    TEST_PROG prog;
+    test_prog_init(&prog);
+    test_config(&prog);
+    test_d1(&prog, 0x80000);
+    test_lc(&prog, 0x7fff);
+    test_emit(&prog, "D5");
+    uint32_t loop = prog.pc;
+    // DAT1=A B, D1=D1+2, B=B-1 A
+    test_emit(&prog, "1516171CD");
+    test_branch(&prog, "5", loop);
+    test_emit(&prog, "807");
+    RESULT with, without;
+    run(&prog, true, true, &with);
+    run(&prog, false, false, &without);
+    compare(-1, &with, &without);
+    free(prog.rom);
+}
+
+int main() {
+    int loops = 0, matched = 0;
+    for (int i = 0; i < PROGRAMS; i++) {
+        TEST_PROG prog;
+        uint32_t starts[MAX_LOOPS];
+        int count = build_program(&prog, 0x5eed0000 + i, starts);
+        RESULT with, without;
+        run(&prog, true, false, &with);
+        for (int j = 0; j < count; j++) {
+            BLOCK block;
+            translate_block(&block, starts[j]);
+            matched += (block.uop[0].op == UOP_LOOP);
+        }
+        run(&prog, false, false, &without);
+        compare(i, &with, &without);
+        CHECK(with.cpu.shutdown, "program %d did not finish", i);
+        loops += count;
+        free(prog.rom);
+    }
+    // Most loops are written as idioms, the test is useless if they stop
+    // matching
+    CHECK(matched * 2 > loops, "only %d of %d loops matched an idiom",
+            matched, loops);
+    test_long_loop();
+    idiom_enable = true;
+    return test_result("idiom_test");
+}
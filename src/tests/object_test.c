@@ -0,0 +1,200 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "cpu.h"
+#include "emu.h"
+#include "object.h"
+#include "tests/test.h"
+
+// Object sizes, loading, and pushing and reading objects back on a fake
+// RPL memory layout: an empty TEMPOB at 81000 below a 16 nibble return
+// stack, and an empty data stack at 82000.
+
+#define TEMPOB      (0x806e9)
+#define TEMPTOP     (0x806ee)
+#define RSKTOP      (0x806f3)
+#define DSKTOP      (0x806f8)
+#define EDITLINE    (0x806fd)
+
+#define BASE        (0x81000)
+#define RSTK_SIZE   (16)
+#define STACK       (0x82000)
+
+static int put(uint8_t *obj, int pos, uint64_t value, int n) {
+    for (int i = 0; i < n; i++)
+        obj[pos + i] = (value >> (i * 4)) & 0xf;
+    return pos + n;
+}
+
+// System binary, 10 nibbles
+static int make_bint(uint8_t *obj, uint32_t value) {
+    return put(obj, put(obj, 0, 0x02911, 5), value, 5);
+}
+
+// List of a system binary, the string "AB" and a ROM object pointer, 39
+// nibbles
+static int make_list(uint8_t *obj) {
+    int pos = put(obj, 0, 0x02a74, 5);
+    pos += make_bint(obj + pos, 42);
+    pos = put(obj, pos, 0x02a2c, 5);
+    pos = put(obj, pos, 9, 5);
+    pos = put(obj, pos, 0x4241, 4);
+    pos = put(obj, pos, 0x03ff9, 5);
+    return put(obj, pos, 0x0312b, 5);
+}
+
+static void reset_memory() {
+    emu_init();
+    memory_config(0x7f000);
+    memory_config((0x100000 - RAM_NIBBLES) & ADDR_MASK);
+    memory_config(0x80000);
+    memory_write(TEMPOB, BASE, 5);
+    memory_write(TEMPTOP, BASE, 5);
+    memory_write(RSKTOP, BASE + RSTK_SIZE, 5);
+    memory_write(DSKTOP, STACK, 5);
+    memory_write(EDITLINE, STACK + 5, 5);
+    memory_write(BASE, 0xfedcba9876543210ull, RSTK_SIZE);
+    // Stack bottom marker
+    memory_write(STACK, 0, 5);
+}
+
+static void test_size() {
+    uint8_t obj[64];
+    CHECK(make_bint(obj, 7) == 10, "bint built wrong");
+    CHECK(object_size(obj, 10) == 10, "bint size wrong");
+    CHECK(object_size(obj, 9) == -1, "truncated bint has a size");
+    int n = make_list(obj);
+    CHECK(object_size(obj, n) == n, "list size %d, expected %d",
+            object_size(obj, n), n);
+    CHECK(object_size(obj, n - 1) == -1, "list without SEMI has a size");
+    put(obj, 0, 0x12345, 5);
+    CHECK(object_size(obj, n) == -1, "unknown prolog has a size");
+}
+
+static void test_load() {
+    char fn[64];
+    snprintf(fn, sizeof(fn), "/tmp/object_test.%d", (int)getpid());
+    // A character object, 7 nibbles in 4 bytes
+    static const uint8_t file[] = "HPHP48-E\xbf\x29\x20\x41";
+    FILE *fp = fopen(fn, "wb");
+    CHECK(fp, "can not write %s", fn);
+    if (!fp)
+        return;
+    fwrite(file, sizeof(file) - 1, 1, fp);
+    fclose(fp);
+    uint8_t *obj;
+    int n = object_load(fn, &obj);
+    CHECK(n == 7, "loaded %d nibbles, expected 7", n);
+    if (n == 7) {
+        static const uint8_t expected[7] = { 0xf, 0xb, 0x9, 0x2, 0x0, 0x2,
+                0x1 };
+        CHECK(!memcmp(obj, expected, 7), "character object loaded wrong");
+        free(obj);
+    }
+    unlink(fn);
+}
+
+static void check_level(int level, const uint8_t *expected, int size,
+        uint32_t expected_address) {
+    uint8_t *obj;
+    uint32_t address;
+    int n = object_read(level, &obj, &address);
+    CHECK(n == size, "level %d is %d nibbles, expected %d", level, n, size);
+    if (n != size)
+        return;
+    CHECK(address == expected_address, "level %d at %05x, expected %05x",
+            level, address, expected_address);
+    CHECK(!memcmp(obj, expected, size), "level %d reads back wrong", level);
+    free(obj);
+}
+
+static void test_push() {
+    uint8_t bint[16], list[64];
+    int bint_size = make_bint(bint, 0x12345);
+    int list_size = make_list(list);
+    reset_memory();
+    cpu.d[1] = STACK;
+    cpu.reg[R_B] = BASE + RSTK_SIZE;
+
+    uint32_t first, second;
+    CHECK(object_push(bint, bint_size, &first), "bint push failed");
+    CHECK(object_push(list, list_size, &second), "list push failed");
+    uint32_t room = bint_size + 5 + list_size + 5;
+    CHECK(first == BASE, "bint at %05x", first);
+    CHECK(second == BASE + (uint32_t)bint_size + 5, "list at %05x", second);
+    CHECK(memory_read(first + bint_size, 5) == (uint32_t)bint_size + 5,
+            "bint link wrong");
+    CHECK(memory_read(second + list_size, 5) == (uint32_t)list_size + 5,
+            "list link wrong");
+
+    // Pointers and the registers holding them follow
+    CHECK(memory_read(TEMPTOP, 5) == BASE + room, "TEMPTOP wrong");
+    CHECK(memory_read(RSKTOP, 5) == BASE + RSTK_SIZE + room, "RSKTOP wrong");
+    CHECK(memory_read(DSKTOP, 5) == STACK - 10, "DSKTOP wrong");
+    CHECK(cpu.d[1] == STACK - 10, "D1 did not follow DSKTOP");
+    CHECK((cpu.reg[R_B] & ADDR_MASK) == BASE + RSTK_SIZE + room,
+            "B did not follow RSKTOP");
+    CHECK(memory_read(BASE + room, RSTK_SIZE) == 0xfedcba9876543210ull,
+            "return stack not moved");
+
+    check_level(1, list, list_size, second);
+    check_level(2, bint, bint_size, first);
+    uint8_t *obj;
+    uint32_t address;
+    CHECK(object_read(3, &obj, &address) == -1, "read past the stack bottom");
+    CHECK(object_read(0, &obj, &address) == -1, "read level 0");
+    CHECK(object_read(0x7fffffff, &obj, &address) == -1, "read level 2^31-1");
+    CHECK(object_read(0x33333334, &obj, &address) == -1,
+            "read a level wrapping around to the top");
+
+    // No room left between the return stack and the data stack
+    memory_write(DSKTOP, BASE + RSTK_SIZE + room + list_size + 5, 5);
+    CHECK(!object_push(list, list_size, &address), "push into full memory");
+    CHECK(memory_read(TEMPTOP, 5) == BASE + room, "failed push moved TEMPTOP");
+
+    // Pointers out of order
+    reset_memory();
+    memory_write(RSKTOP, BASE - 1, 5);
+    CHECK(!object_push(bint, bint_size, &address), "push with bad pointers");
+}
+
+int main() {
+    uint8_t *image = calloc(ROM_SIZE, 1);
+    if (!image)
+        return 1;
+    rom_init(image, ROM_SIZE);
+    test_size();
+    test_load();
+    test_push();
+    free(image);
+    return test_result("object_test");
+}
@@ -0,0 +1,145 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "ram.h"
+#include "tests/test.h"
+
+// RAM accessors against a plain nibble array. Run with both RAM_PACKED
+// settings, the packed layout is where odd addresses and 16 nibble accesses
+// need care.
+
+#define ROUNDS      (200000)
+
+static uint8_t ref[RAM_NIBBLES];
+
+// Random address for an access of n nibbles, often at the ends of RAM
+static size_t random_address(uint64_t *seed, int n) {
+    switch (test_rand(seed) % 4) {
+    case 0:
+        return test_rand(seed) % 32;
+    case 1:
+        return RAM_NIBBLES - n - test_rand(seed) % 32;
+    default:
+        return test_rand(seed) % (RAM_NIBBLES - n + 1);
+    }
+}
+
+static uint64_t ref_load(size_t address, int n) {
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++)
+        value |= (uint64_t)ref[address + i] << (i * 4);
+    return value;
+}
+
+static void ref_store(size_t address, uint64_t value, int n) {
+    for (int i = 0; i < n; i++)
+        ref[address + i] = (value >> (i * 4)) & 0xf;
+}
+
+static void test_accesses() {
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (int round = 0; round < ROUNDS; round++) {
+        int n = test_rand(&seed) % 16 + 1;
+        size_t address = random_address(&seed, n);
+        uint64_t value = ((uint64_t)test_rand(&seed) << 32) |
+                test_rand(&seed);
+        switch (test_rand(&seed) % 4) {
+        case 0:
+            ram_write(address, value & 0xf);
+            ref[address] = value & 0xf;
+            break;
+        case 1:
+            ram_store(address, value, n);
+            ref_store(address, value, n);
+            break;
+        case 2: {
+            uint64_t got = ram_load(address, n);
+            CHECK(got == ref_load(address, n),
+                    "ram_load(%05zx, %d) = %016llx, expected %016llx",
+                    address, n, (unsigned long long)got,
+                    (unsigned long long)ref_load(address, n));
+            break;
+        }
+        case 3:
+            CHECK(ram_read(address) == ref[address],
+                    "ram_read(%05zx) = %x, expected %x", address,
+                    ram_read(address), ref[address]);
+            break;
+        }
+    }
+    for (size_t address = 0; address < RAM_NIBBLES; address++)
+        CHECK(ram_read(address) == ref[address],
+                "ram_read(%05zx) = %x, expected %x after stores", address,
+                ram_read(address), ref[address]);
+}
+
+static void test_moves() {
+    uint64_t seed = 0x2545f4914f6cdd1dull;
+    for (int round = 0; round < 2000; round++) {
+        size_t n = test_rand(&seed) % 300 + 1;
+        size_t src = random_address(&seed, n);
+        // Mostly overlapping moves, in both directions
+        size_t dst = (test_rand(&seed) % 4) ? src + test_rand(&seed) % 40 - 20 :
+                random_address(&seed, n);
+        if (dst > RAM_NIBBLES - n)
+            dst = RAM_NIBBLES - n;
+        ram_move(dst, src, n);
+        memmove(&ref[dst], &ref[src], n);
+        size_t lo = ((dst < 20) ? 0 : dst - 20);
+        size_t hi = ((dst + n + 20 > RAM_NIBBLES) ? RAM_NIBBLES : dst + n + 20);
+        for (size_t address = lo; address < hi; address++) {
+            if (ram_read(address) != ref[address]) {
+                CHECK(false, "ram_move(%05zx, %05zx, %zu) wrong at %05zx",
+                        dst, src, n, address);
+                break;
+            }
+        }
+    }
+}
+
+static void test_dirty() {
+    // A store across a page boundary marks both pages
+    size_t address = (5 << RAM_PAGE_SHIFT) - 3;
+    memset(ram_dirty, 0, RAM_PAGES);
+    ram_store(address, 0x123456789abcdefull, 16);
+    CHECK(ram_dirty[4] && ram_dirty[5] && !ram_dirty[3] && !ram_dirty[6],
+            "ram_store() dirty pages wrong");
+    memset(ram_dirty, 0, RAM_PAGES);
+    ram_move(address, 0, 1 << RAM_PAGE_SHIFT);
+    CHECK(ram_dirty[4] && ram_dirty[5] && !ram_dirty[6],
+            "ram_move() dirty pages wrong");
+}
+
+int main() {
+    ram_init();
+    memset(ref, 0, sizeof(ref));
+    test_accesses();
+    test_moves();
+    test_dirty();
+    return test_result("ram_test");
+}
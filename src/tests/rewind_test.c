@@ -0,0 +1,174 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "rom.h"
+#include "memory.h"
+#include "ram.h"
+#include "io.h"
+#include "cpu.h"
+#include "emu.h"
+#include "rewind.h"
+#include "sample.h"
+#include "tests/test.h"
+
+// Rewinding against straight runs. A program keeps writing RAM all over
+// the module, the state after rewinding to a cycle and running up to a
+// target must equal a run that went to the target directly.
+
+#define RING_SIZE   (320 * 1024) // Just above the minimum
+#define INTERVAL    (20000)
+#define RUN_CYCLES  (3200000)
+#define TARGETS     (5)
+
+static const uint64_t targets[TARGETS] = {
+    3190000, 3100000, 3050000, 2900000, 2850000
+};
+
+typedef struct {
+    CPU_STATE cpu;
+    uint64_t ram;
+} STATE;
+
+static void build_program(TEST_PROG *prog) {
+    test_prog_init(prog);
+    test_config(prog);
+    // A=12345 and C=FFFFF, the loop adds them into each other so every
+    // store writes a new value
+    test_lc(prog, 0x12345);
+    test_emit(prog, "DAAF2CE");
+    uint32_t outer = prog->pc;
+    test_d1(prog, 0x80000);
+    test_lc(prog, 0x4000);
+    test_emit(prog, "D5");
+    uint32_t inner = prog->pc;
+    // DAT1=A W, A=A+C A, C=C+A A, D1=D1+13, B=B-1 A, GONC inner
+    test_emit(prog, "1517CAC217CCD");
+    test_branch(prog, "5", inner);
+    // GOTO outer
+    test_emit(prog, "6");
+    test_emit_value(prog, outer - prog->pc, 3);
+}
+
+static void get_state(STATE *state) {
+    state->cpu = cpu;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint32_t address = 0; address < RAM_NIBBLES; address++) {
+        h ^= ram_read(address);
+        h *= 0x100000001b3ull;
+    }
+    for (uint32_t offset = 0; offset < IO_SIZE; offset++) {
+        h ^= io_read(offset);
+        h *= 0x100000001b3ull;
+    }
+    state->ram = h;
+}
+
+static bool same_state(const STATE *a, const STATE *b) {
+    const CPU_STATE *x = &a->cpu, *y = &b->cpu;
+    for (int i = 0; i < 4; i++)
+        if (x->reg[i] != y->reg[i])
+            return false;
+    return (x->pc == y->pc) && (x->d[0] == y->d[0]) &&
+            (x->d[1] == y->d[1]) && (x->p == y->p) && (x->st == y->st) &&
+            (x->carry == y->carry) && (x->cycles == y->cycles) &&
+            (x->insns == y->insns) && (a->ram == b->ram);
+}
+
+static void test_targets(const TEST_PROG *prog) {
+    // Straight runs to each target, oldest first
+    STATE expected[TARGETS];
+    rom_init(prog->rom, ROM_SIZE);
+    emu_init();
+    for (int i = TARGETS - 1; i >= 0; i--) {
+        emu_run(targets[i] - cpu.cycles);
+        get_state(&expected[i]);
+    }
+
+    emu_init();
+    CHECK(rewind_open(RING_SIZE, INTERVAL), "rewind_open failed");
+    emu_run(RUN_CYCLES);
+    int frames;
+    size_t bytes;
+    uint64_t oldest;
+    rewind_stats(&frames, &bytes, &oldest);
+    CHECK(oldest > 0, "ring never dropped a checkpoint");
+    CHECK(!rewind_to(oldest - 1), "rewound past the oldest checkpoint");
+    for (int i = 0; i < TARGETS; i++) {
+        CHECK(targets[i] >= oldest, "target %llu is gone",
+                (unsigned long long)targets[i]);
+        if (!rewind_to(targets[i]))
+            continue;
+        emu_run(targets[i] - cpu.cycles);
+        STATE state;
+        get_state(&state);
+        CHECK(same_state(&state, &expected[i]), "state at %llu differs",
+                (unsigned long long)targets[i]);
+        if (i == 0) {
+            // Run on over the dropped checkpoints and come back again
+            emu_run(300000);
+            CHECK(rewind_to(targets[i]), "second rewind failed");
+            emu_run(targets[i] - cpu.cycles);
+            get_state(&state);
+            CHECK(same_state(&state, &expected[i]),
+                    "state at %llu differs after running on",
+                    (unsigned long long)targets[i]);
+        }
+    }
+    rewind_close();
+}
+
+// The keyboard and the profiler schedule are part of the rewound state
+static void test_keys(const TEST_PROG *prog) {
+    rom_init(prog->rom, ROM_SIZE);
+    emu_init();
+    CHECK(rewind_open(RING_SIZE, INTERVAL), "rewind_open failed");
+    CHECK(sample_open(1000), "sample_open failed");
+    emu_run(100000);
+    uint64_t before = cpu.cycles;
+    io_key(3, 5, true);
+    emu_run(100000);
+    uint64_t pressed = cpu.cycles;
+    emu_run(100000);
+
+    CHECK(rewind_to(pressed), "rewind while pressed failed");
+    CHECK(io_keyboard(1 << 3) == (1 << 5), "key not pressed after rewinding");
+    CHECK(sample_next <= cpu.cycles + 1000, "sampling not rescheduled");
+    CHECK(rewind_to(before), "rewind before the press failed");
+    CHECK(io_keyboard(0xfff) == 0, "key pressed before it was");
+    sample_close();
+    rewind_close();
+}
+
+int main() {
+    TEST_PROG prog;
+    build_program(&prog);
+    test_targets(&prog);
+    test_keys(&prog);
+    free(prog.rom);
+    return test_result("rewind_test");
+}
@@ -0,0 +1,143 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "idiom.h"
+#include "tcache.h"
+#include "emu.h"
+#include "tests/test.h"
+
+// Translation cache round trips. Blocks of a random ROM are saved, loaded
+// back and compared with a fresh translation, and files that do not match
+// the ROM, the translator options or a valid layout must be rejected.
+
+#define PC_STEP     (7)
+#define FIRST_PASS  (PC_STEP * 20000)
+#define LAST_PASS   (PC_STEP * 40000)
+
+static char fn[64];
+static BLOCK block, cached;
+
+static bool same_uop(const UOP *a, const UOP *b) {
+    return (a->op == b->op) && (a->field == b->field) && (a->dst == b->dst) &&
+            (a->src == b->src) && (a->length == b->length) &&
+            (a->flags == b->flags) && (a->pc == b->pc) &&
+            (a->target == b->target) && (a->imm == b->imm);
+}
+
+static void add_blocks(uint32_t start, uint32_t end) {
+    for (uint32_t pc = start; pc < end; pc += PC_STEP) {
+        translate_block(&block, pc);
+        tcache_add(&block);
+    }
+}
+
+// Every block in the range must load as translated, returns the hits
+static int check_blocks(uint32_t start, uint32_t end) {
+    int hits = 0;
+    for (uint32_t pc = start; pc < end; pc += PC_STEP) {
+        translate_block(&block, pc);
+        if (!tcache_load(&cached, pc))
+            continue;
+        hits++;
+        bool same = (cached.pc == block.pc) && (cached.end == block.end) &&
+                (cached.count == block.count) &&
+                (cached.carry_elided == block.carry_elided) &&
+                (cached.dead_elided == block.dead_elided);
+        for (int i = 0; same && (i < block.count); i++)
+            same = same_uop(&cached.uop[i], &block.uop[i]);
+        CHECK(same, "block at %05x differs after loading", pc);
+    }
+    return hits;
+}
+
+static void test_round_trip() {
+    unlink(fn);
+    CHECK(!tcache_open(fn), "opened a missing cache");
+    add_blocks(0, FIRST_PASS);
+    CHECK(tcache_save(), "first save failed");
+
+    // Blocks added to an open cache are merged with the mapped ones
+    CHECK(tcache_open(fn), "saved cache does not open");
+    add_blocks(FIRST_PASS, LAST_PASS);
+    CHECK(tcache_save(), "second save failed");
+
+    CHECK(tcache_open(fn), "merged cache does not open");
+    int expected = LAST_PASS / PC_STEP;
+    int hits = check_blocks(0, LAST_PASS);
+    CHECK(hits == expected, "%d of %d blocks loaded", hits, expected);
+    CHECK(!tcache_load(&cached, LAST_PASS + 1), "loaded a block not saved");
+    tcache_close();
+}
+
+static void test_rejected(uint8_t *image) {
+    // Blocks translated without idioms may differ
+    idiom_enable = false;
+    CHECK(!tcache_open(fn), "opened with other translator options");
+    idiom_enable = true;
+
+    // A ROM change invalidates everything
+    image[0x100] ^= 1;
+    CHECK(!tcache_open(fn), "opened for another ROM");
+    image[0x100] ^= 1;
+
+    // A cut off file
+    CHECK(!truncate(fn, 4096), "truncate failed");
+    CHECK(!tcache_open(fn), "opened a truncated cache");
+
+    // A record with a uop the handlers can not run. The open fails, the
+    // save then replaces the file with the added block only.
+    tcache_open(fn);
+    translate_block(&block, 0x1000);
+    block.uop[block.count - 1].op = UOP_TYPE_COUNT;
+    tcache_add(&block);
+    CHECK(tcache_save(), "save failed");
+    CHECK(!tcache_open(fn), "opened a cache with an invalid uop");
+    tcache_close();
+}
+
+int main() {
+    uint8_t *image = malloc(ROM_SIZE);
+    if (!image)
+        return 1;
+    uint64_t seed = 0x853c49e6748fea9bull;
+    for (int i = 0; i < ROM_SIZE; i++)
+        image[i] = test_rand(&seed) & 0xf;
+    rom_init(image, ROM_SIZE);
+    emu_init();
+    snprintf(fn, sizeof(fn), "/tmp/tcache_test.%d", (int)getpid());
+
+    test_round_trip();
+    test_rejected(image);
+    unlink(fn);
+    free(image);
+    return test_result("tcache_test");
+}
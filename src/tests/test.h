@@ -0,0 +1,111 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+// Shared helpers for the test programs. A failed CHECK prints its location
+// and message, test_result() reports and gives the exit status.
+
+static int test_failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        test_failures++; \
+    } \
+} while (0)
+
+static inline int test_result(const char *name) {
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+    return test_failures ? 1 : 0;
+}
+
+// Deterministic xorshift generator, so failures can be reproduced
+static inline uint32_t test_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state >> 32;
+}
+
+// Builder for small test programs, one nibble per byte from address 0 of a
+// ROM image
+typedef struct {
+    uint8_t *rom;
+    uint32_t pc;
+} TEST_PROG;
+
+static inline void test_prog_init(TEST_PROG *prog) {
+    prog->rom = calloc(ROM_SIZE, 1);
+    if (!prog->rom)
+        abort();
+    prog->pc = 0;
+}
+
+// Append hex digits in program order
+static inline void test_emit(TEST_PROG *prog, const char *hex) {
+    for (; *hex; hex++) {
+        char c = *hex;
+        prog->rom[prog->pc++] = (c <= '9') ? c - '0' : (c & 0x7) + 9;
+    }
+}
+
+// Append an n nibble operand, lowest nibble first
+static inline void test_emit_value(TEST_PROG *prog, uint64_t value, int n) {
+    for (int i = 0; i < n; i++)
+        prog->rom[prog->pc++] = (value >> (i * 4)) & 0xf;
+}
+
+static inline void test_lc(TEST_PROG *prog, uint32_t value) {
+    test_emit(prog, "34");
+    test_emit_value(prog, value, 5);
+}
+
+static inline void test_d0(TEST_PROG *prog, uint32_t address) {
+    test_emit(prog, "1B");
+    test_emit_value(prog, address, 5);
+}
+
+static inline void test_d1(TEST_PROG *prog, uint32_t address) {
+    test_emit(prog, "1F");
+    test_emit_value(prog, address, 5);
+}
+
+// Conditional jump with a 2 nibble offset, like GONC or a GOYES after a
+// test. The offset is relative to its own address.
+static inline void test_branch(TEST_PROG *prog, const char *prefix,
+        uint32_t target) {
+    test_emit(prog, prefix);
+    test_emit_value(prog, target - prog->pc, 2);
+}
+
+// Map the I/O registers at 7F000 and RAM at 80000, as in the HP 48G
+static inline void test_config(TEST_PROG *prog) {
+    test_lc(prog, 0x7f000);
+    test_emit(prog, "805");
+    test_lc(prog, (0x100000 - RAM_NIBBLES) & ADDR_MASK);
+    test_emit(prog, "805");
+    test_lc(prog, 0x80000);
+    test_emit(prog, "805");
+}
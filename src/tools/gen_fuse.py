@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# Satrec
+# Copyright 2022 Wenting Zhang
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Generate fuse_table.h, the fused uop handlers used by exec.c.
+#
+# Usage: gen_fuse.py <profile> <translate.h> > fuse_table.h
+#
+# The profile is the output of "satrec -p", one sequence per line:
+#   <count> <UOP> <UOP> [<UOP>]
+# Lines starting with # are ignored. The most frequent pairs and triples are
+# fused, and so is every carry producing uop followed by a carry branch.
+
+import re
+import sys
+
+MAX_PAIRS = 48
+MAX_TRIPLES = 16
+
+# Uops setting carry, and branches reading it. These are always fused.
+CARRY_OPS = ["ADD", "SUB", "RSUB", "INC", "DEC", "ADDCON", "SUBCON", "NEG",
+        "DADD", "DSUB", "PINC", "PDEC", "CPP1"]
+CARRY_BRANCHES = ["GOC", "GONC", "RTNC", "RTNNC"]
+
+def read_ops(fn):
+    src = open(fn).read()
+    body = re.search(r"typedef enum \{(.*?)\} UOP_TYPE;", src, re.S).group(1)
+    body = re.sub(r"//.*", "", body)
+    return [op[4:] for op in re.findall(r"UOP_\w+", body)
+            if op != "UOP_TYPE_COUNT"]
+
+def read_profile(fn, ops):
+    pairs = {}
+    triples = {}
+    for line in open(fn):
+        line = line.split("#")[0].split()
+        if not line:
+            continue
+        count = int(line[0])
+        seq = tuple(line[1:])
+        for op in seq:
+            if op not in ops:
+                sys.exit("unknown uop %s in %s" % (op, fn))
+        if len(seq) == 2:
+            pairs[seq] = pairs.get(seq, 0) + count
+        elif len(seq) == 3:
+            triples[seq] = triples.get(seq, 0) + count
+        else:
+            sys.exit("bad sequence length in %s" % fn)
+    return pairs, triples
+
+def top(seqs, n):
+    # Sort by count, then by name so the output is stable
+    return [s for s, c in sorted(seqs.items(), key=lambda x: (-x[1], x[0]))][:n]
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: gen_fuse.py <profile> <translate.h>")
+    ops = read_ops(sys.argv[2])
+    pairs, triples = read_profile(sys.argv[1], ops)
+
+    seqs = [(op, br) for op in CARRY_OPS for br in CARRY_BRANCHES]
+    for s in top(pairs, MAX_PAIRS) + top(triples, MAX_TRIPLES):
+        if s not in seqs:
+            seqs.append(s)
+
+    print("// Generated by tools/gen_fuse.py from %s, do not edit" %
+            sys.argv[1].split("/")[-1])
+    print()
+    for s in seqs:
+        name = "fuse_" + "_".join(op.lower() for op in s)
+        print("static int %s(const UOP *u) {" % name)
+        for i, op in enumerate(s[:-1]):
+            print("    op_%s(&u[%d]);" % (op.lower(), i))
+        print("    return op_%s(&u[%d]);" % (s[-1].lower(), len(s) - 1))
+        print("}")
+        print()
+    print("static const FUSE_ENTRY fuse_table[] = {")
+    for s in seqs:
+        name = "fuse_" + "_".join(op.lower() for op in s)
+        uops = ", ".join("UOP_" + op for op in s)
+        print("    {%d, {%s}, %s}," % (len(s), uops, name))
+    print("    {0, {0}, NULL}")
+    print("};")
+
+main()
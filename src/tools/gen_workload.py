@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# Satrec
+# Copyright 2022 Wenting Zhang
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Generate the ROM image profiled for fuse_profile.txt, see make profile.
+#
+# Usage: gen_workload.py <rom file>
+#
+# The workload is a mix of the loops ROM code spends its time in: block
+# copies in every direction, fills, scans, checksums and short subroutine
+# calls, with RAM seeded from pseudo random ROM data. It repeats until the
+# cycle limit of the run, one byte per nibble from address 0.
+
+import sys
+
+ROM_NIBBLES = 0x100000
+
+
+def h(value, n):
+    return "".join("%X" % ((value >> (4 * i)) & 0xf) for i in range(n))
+
+
+class Program:
+    def __init__(self):
+        self.items = []
+
+    def emit(self, hex_digits):
+        self.items.append(("raw", hex_digits.replace(" ", "")))
+
+    def label(self, name):
+        self.items.append(("label", name))
+
+    # Jump with an n nibble offset relative to the offset plus bias, like
+    # GONC and GOYES (2, 0), GOTO (3, 0) or GOSUB (3, 3)
+    def jump(self, prefix, name, n=2, bias=0):
+        self.items.append(("jump", prefix, name, n, bias))
+
+    def lc(self, value):
+        self.emit("34" + h(value, 5))
+
+    def d0(self, address):
+        self.emit("1B" + h(address, 5))
+
+    def d1(self, address):
+        self.emit("1F" + h(address, 5))
+
+    # B(A) = count, for loops ending with B=B-1 A and GONC
+    def count(self, n):
+        self.lc(n - 1)
+        self.emit("D5")
+
+    def assemble(self):
+        labels = {}
+        for _ in range(2):
+            pc = 0
+            out = []
+            for item in self.items:
+                if item[0] == "label":
+                    labels[item[1]] = pc
+                elif item[0] == "raw":
+                    out.append(item[1])
+                    pc += len(item[1])
+                else:
+                    _, prefix, name, n, bias = item
+                    at = pc + len(prefix)
+                    offset = labels.get(name, at) - at - bias
+                    out.append(prefix + h(offset & ((1 << (4 * n)) - 1), n))
+                    pc = at + n
+        return "".join(out)
+
+
+def workload():
+    p = Program()
+    # I/O registers at 7F000, RAM at 80000
+    p.lc(0x7f000)
+    p.emit("805")
+    p.lc(0xc0000)
+    p.emit("805")
+    p.lc(0x80000)
+    p.emit("805")
+    # Seed RAM from the data at 1000, 16 nibbles at a time
+    p.d0(0x1000)
+    p.d1(0x80000)
+    p.count(256)
+    p.label("seed")
+    p.emit("1527 1517 16F 17F CD")
+    p.jump("5", "seed")
+
+    p.label("main")
+    # Word copies up, A=DAT0 W, DAT1=A W, D0=D0+16, D1=D1+16
+    for src, dst, n in ((0x1000, 0x81000, 64), (0x80000, 0x80008, 20),
+                        (0x80100, 0x800f0, 30)):
+        p.d0(src)
+        p.d1(dst)
+        p.count(n)
+        p.label("up%x" % dst)
+        p.emit("1527 1517 16F 17F CD")
+        p.jump("5", "up%x" % dst)
+    # Byte fill, DAT1=A B, D1=D1+2
+    p.emit("80824" + h(0x5a, 5))
+    p.d1(0x80400)
+    p.count(100)
+    p.label("fill")
+    p.emit("1516 171 CD")
+    p.jump("5", "fill")
+    # Word copy down, D0=D0-16, D1=D1-16
+    p.d0(0x80300)
+    p.d1(0x80800)
+    p.count(16)
+    p.label("down")
+    p.emit("1527 1517 18F 1CF CD")
+    p.jump("5", "down")
+    # Scan for the fill byte, C=DAT0 B, D0=D0+2, ?C#A B
+    p.d0(0x80000)
+    p.label("scan")
+    p.emit("1566 161")
+    p.jump("966", "scan")
+    # X field copy ending on ?B#0 A
+    p.d0(0x1100)
+    p.d1(0x80a00)
+    p.lc(40)
+    p.emit("D5")
+    p.label("xcopy")
+    p.emit("1523 1513 162 172 CD")
+    p.jump("8AD", "xcopy")
+    # Checksum of A fields, C=DAT0 A, A=A+C A, D0=D0+5
+    p.emit("AF0")
+    p.d0(0x80000)
+    p.count(200)
+    p.label("sum")
+    p.emit("146 CA 164 CD")
+    p.jump("5", "sum")
+    p.d1(0x80c00)
+    p.emit("141")
+    # Counter update in a subroutine, D=D-1 A counts the calls
+    p.lc(49)
+    p.emit("D7")
+    p.label("calls")
+    p.jump("7", "bump", 3, 3)
+    p.emit("CF")
+    p.jump("5", "calls")
+    p.jump("6", "main", 3)
+
+    # A=DAT1 X, A=A+1 A, DAT1=A X, RTN
+    p.label("bump")
+    p.d1(0x80c10)
+    p.emit("1533 E4 1513 01")
+    return p.assemble()
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: gen_workload.py <rom file>")
+    rom = bytearray(ROM_NIBBLES)
+    for i, c in enumerate(workload()):
+        rom[i] = int(c, 16)
+    # Data for the copies, from a linear congruential generator
+    seed = 1
+    for i in range(0x1000, 0x2000):
+        seed = (seed * 1103515245 + 12345) & 0x7fffffff
+        rom[i] = (seed >> 16) & 0xf
+    with open(sys.argv[1], "wb") as f:
+        f.write(rom)
+
+
+if __name__ == "__main__":
+    main()
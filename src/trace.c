@@ -0,0 +1,222 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "memory.h"
+#include "cpu.h"
+#include "trace.h"
+
+// Execution trace. Every thread running the CPU gets its own single
+// producer, single consumer byte ring, so recording a block entry is a
+// varint encode and a copy with no locking. A writer thread drains the rings
+// to the trace file. When a ring is full the producer waits for the writer
+// instead of dropping entries, a trace with holes is useless for debugging.
+
+#define RING_SIZE       (1 << 20) // Bytes, power of 2
+#define MAX_ENTRY       (64) // Largest encoded entry, with a snapshot
+
+typedef struct {
+    _Atomic uint32_t head;  // Written by the producer
+    _Atomic uint32_t tail;  // Written by the writer thread
+    uint32_t id;
+    uint32_t last_pc;
+    int countdown;          // Blocks until the next snapshot
+    uint8_t buf[RING_SIZE];
+} TRACE_RING;
+
+bool trace_enabled;
+
+static FILE *trace_fp;
+static uint32_t trace_regs;
+static int trace_interval;
+static pthread_t writer;
+static atomic_bool writer_stop;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static TRACE_RING *rings[TRACE_MAX_THREADS];
+static _Atomic int ring_count;
+static _Atomic uint32_t generation; // Bumped when trace_close frees the rings
+static _Thread_local TRACE_RING *ring;
+static _Thread_local uint32_t ring_generation;
+
+// Write everything available in a ring as one chunk, returns bytes written
+static uint32_t flush_ring(TRACE_RING *r) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint32_t size = head - tail;
+    if (!size)
+        return 0;
+    TRACE_CHUNK chunk = { r->id, size };
+    fwrite(&chunk, sizeof(chunk), 1, trace_fp);
+    uint32_t start = tail & (RING_SIZE - 1);
+    uint32_t first = (size < RING_SIZE - start) ? size : RING_SIZE - start;
+    fwrite(&r->buf[start], first, 1, trace_fp);
+    if (first < size)
+        fwrite(r->buf, size - first, 1, trace_fp);
+    atomic_store_explicit(&r->tail, head, memory_order_release);
+    return size;
+}
+
+static void *writer_main(void *arg) {
+    for (;;) {
+        bool stop = atomic_load(&writer_stop);
+        uint32_t written = 0;
+        int count = atomic_load(&ring_count);
+        for (int i = 0; i < count; i++)
+            written += flush_ring(rings[i]);
+        if (stop && !written)
+            break;
+        if (!written)
+            usleep(1000);
+    }
+    return NULL;
+}
+
+// Start tracing to fn, with a snapshot of regs every interval blocks (0 for
+// none)
+bool trace_open(const char *fn, uint32_t regs, int interval) {
+    trace_fp = fopen(fn, "wb");
+    if (!trace_fp)
+        return false;
+    TRACE_HEADER header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .rom_hash = rom_hash(),
+        .regs = regs
+    };
+    fwrite(&header, sizeof(header), 1, trace_fp);
+    trace_regs = regs;
+    trace_interval = interval;
+    atomic_store(&writer_stop, false);
+    if (pthread_create(&writer, NULL, writer_main, NULL)) {
+        fclose(trace_fp);
+        return false;
+    }
+    trace_enabled = true;
+    return true;
+}
+
+static TRACE_RING *ring_create() {
+    TRACE_RING *r = calloc(1, sizeof(TRACE_RING));
+    if (!r)
+        fatal("Unable to allocate trace buffer\n");
+    pthread_mutex_lock(&rings_lock);
+    int count = atomic_load(&ring_count);
+    if (count == TRACE_MAX_THREADS)
+        fatal("Too many traced threads\n");
+    r->id = count;
+    r->countdown = 0;
+    rings[count] = r;
+    atomic_store(&ring_count, count + 1);
+    ring_generation = atomic_load(&generation);
+    pthread_mutex_unlock(&rings_lock);
+    return r;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        *p++ = v >> (i * 8);
+    return p;
+}
+
+// Record entry to the block at pc, called before the block runs
+void trace_block(uint32_t pc) {
+    // A ring left from an earlier trace has been freed by trace_close()
+    if (!ring || (ring_generation != atomic_load_explicit(&generation,
+            memory_order_acquire)))
+        ring = ring_create();
+
+    uint8_t entry[MAX_ENTRY];
+    int32_t delta = (int32_t)(pc - ring->last_pc);
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    uint32_t flags = 0;
+    if (trace_interval && (--ring->countdown <= 0)) {
+        flags |= TRACE_SNAPSHOT;
+        ring->countdown = trace_interval;
+    }
+    if (memory_map(pc) != MEM_ROM)
+        flags |= TRACE_NOT_ROM;
+    ring->last_pc = pc;
+
+    uint8_t *p = put_varint(entry, ((uint64_t)zigzag << 2) | flags);
+    if (flags & TRACE_SNAPSHOT) {
+        for (int i = 0; i < 4; i++)
+            if (trace_regs & (TRACE_REG_A << i))
+                p = put_le(p, cpu.reg[i], 8);
+        if (trace_regs & TRACE_REG_D0)
+            p = put_le(p, cpu.d[0], 3);
+        if (trace_regs & TRACE_REG_D1)
+            p = put_le(p, cpu.d[1], 3);
+        if (trace_regs & TRACE_REG_PST)
+            p = put_le(p, cpu.p | (cpu.carry << 4) | ((uint64_t)cpu.st << 8) |
+                    ((uint64_t)cpu.hst << 24), 5);
+    }
+
+    uint32_t size = p - entry;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head + size - atomic_load_explicit(&ring->tail,
+            memory_order_acquire) > RING_SIZE)
+        usleep(100);
+    for (uint32_t i = 0; i < size; i++)
+        ring->buf[(head + i) & (RING_SIZE - 1)] = entry[i];
+    atomic_store_explicit(&ring->head, head + size, memory_order_release);
+}
+
+// Stop tracing, after the writer thread has flushed all rings. Other threads
+// must have stopped running the CPU, their rings are freed too.
+void trace_close() {
+    if (!trace_enabled)
+        return;
+    trace_enabled = false;
+    atomic_store(&writer_stop, true);
+    pthread_join(writer, NULL);
+    fclose(trace_fp);
+    trace_fp = NULL;
+    pthread_mutex_lock(&rings_lock);
+    int count = atomic_load(&ring_count);
+    for (int i = 0; i < count; i++) {
+        free(rings[i]);
+        rings[i] = NULL;
+    }
+    atomic_store(&ring_count, 0);
+    atomic_fetch_add(&generation, 1);
+    pthread_mutex_unlock(&rings_lock);
+    ring = NULL;
+}
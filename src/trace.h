@@ -0,0 +1,69 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+// Registers included in trace snapshots
+#define TRACE_REG_A     (1u << 0)
+#define TRACE_REG_B     (1u << 1)
+#define TRACE_REG_C     (1u << 2)
+#define TRACE_REG_D     (1u << 3)
+#define TRACE_REG_D0    (1u << 4)
+#define TRACE_REG_D1    (1u << 5)
+#define TRACE_REG_PST   (1u << 6) // P, carry, ST and HST
+#define TRACE_REG_ALL   (0x7f)
+
+#define TRACE_MAGIC     "STR1"
+#define TRACE_VERSION   (1)
+
+// Trace file layout: TRACE_HEADER, then chunks of a TRACE_CHUNK header
+// followed by size bytes of block entries from one producer thread. Each
+// entry is a varint of (zigzag(pc - previous pc) << 2) | flags, where
+// TRACE_SNAPSHOT means a register snapshot follows and TRACE_NOT_ROM means
+// the block was translated from RAM or a card, so it can not be replayed
+// from the ROM image. Snapshots hold the registers selected in the header,
+// in TRACE_REG_* order, as 8 byte little endian values for A-D, 3 bytes for
+// D0 and D1 and 5 bytes for P, carry and ST, HST.
+
+#define TRACE_SNAPSHOT  (1u << 0)
+#define TRACE_NOT_ROM   (1u << 1)
+
+#define TRACE_MAX_THREADS (16) // Producer indexes are below this
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t rom_hash;
+    uint32_t regs;      // TRACE_REG_* in snapshots
+    uint32_t reserved;
+} TRACE_HEADER;
+
+typedef struct {
+    uint32_t thread;    // Producer index, entries are delta coded per thread
+    uint32_t size;
+} TRACE_CHUNK;
+
+extern bool trace_enabled;
+
+bool trace_open(const char *fn, uint32_t regs, int interval);
+void trace_block(uint32_t pc);
+void trace_close();
@@ -0,0 +1,175 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "disasm.h"
+#include "memory.h"
+#include "translate.h"
+#include "trace.h"
+
+// Offline decoder for traces written by trace.c. Block entries are replayed
+// through the disassembler using the ROM image, blocks that ran from RAM are
+// only listed by address.
+
+static uint32_t regs;
+static bool blocks_only;
+static uint32_t last_pc[TRACE_MAX_THREADS];
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end,
+        uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; p < end; shift += 7) {
+        uint8_t b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+    fatal("Truncated trace entry\n");
+    return p;
+}
+
+static const uint8_t *get_le(const uint8_t *p, const uint8_t *end,
+        uint64_t *v, int bytes) {
+    if (end - p < bytes)
+        fatal("Truncated trace snapshot\n");
+    *v = 0;
+    for (int i = 0; i < bytes; i++)
+        *v |= (uint64_t)*p++ << (i * 8);
+    return p;
+}
+
+static const uint8_t *print_snapshot(const uint8_t *p, const uint8_t *end) {
+    static const char names[] = "ABCD";
+    uint64_t v;
+    printf("     ");
+    for (int i = 0; i < 4; i++) {
+        if (regs & (TRACE_REG_A << i)) {
+            p = get_le(p, end, &v, 8);
+            printf(" %c=%016llx", names[i], (unsigned long long)v);
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (regs & (TRACE_REG_D0 << i)) {
+            p = get_le(p, end, &v, 3);
+            printf(" D%d=%05llx", i, (unsigned long long)v);
+        }
+    }
+    if (regs & TRACE_REG_PST) {
+        p = get_le(p, end, &v, 5);
+        printf(" P=%x CY=%d ST=%04x HST=%x", (int)(v & 0xf),
+                (int)((v >> 4) & 1), (int)((v >> 8) & 0xffff),
+                (int)((v >> 24) & 0xf));
+    }
+    printf("\n");
+    return p;
+}
+
+// Disassemble the basic block starting at pc
+static void print_block(uint32_t pc) {
+    BLOCK block;
+    DISASM instr;
+    translate_decode(&block, pc);
+    for (int i = 0; i < block.count; i++) {
+        disasm(&instr, pc);
+        printf("PC %05x: %s\n", pc, instr.disasm);
+        pc = (pc + instr.length) & ADDR_MASK;
+    }
+}
+
+static void decode_chunk(uint32_t thread, const uint8_t *p,
+        const uint8_t *end) {
+    while (p < end) {
+        uint64_t v;
+        p = get_varint(p, end, &v);
+        uint32_t zigzag = v >> 2;
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        uint32_t pc = last_pc[thread] + delta;
+        last_pc[thread] = pc;
+        if (blocks_only || (v & TRACE_NOT_ROM))
+            printf("BLOCK %05x%s\n", pc, (v & TRACE_NOT_ROM) ? " (RAM)" : "");
+        else
+            print_block(pc);
+        if (v & TRACE_SNAPSHOT)
+            p = print_snapshot(p, end);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options] <trace>\n"
+            "  -r <file>    ROM file (default ROM.48G)\n"
+            "  -b           Only list block entries\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *rom_file = "ROM.48G";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:b")) != -1) {
+        switch (opt) {
+        case 'r': rom_file = optarg; break;
+        case 'b': blocks_only = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    FILE *fp = fopen(argv[optind], "rb");
+    if (!fp)
+        fatal("Unable to open file %s\n", argv[optind]);
+    TRACE_HEADER header;
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+            memcmp(header.magic, TRACE_MAGIC, 4) ||
+            (header.version != TRACE_VERSION))
+        fatal("%s is not a trace file\n", argv[optind]);
+    regs = header.regs;
+
+    size_t rom_size;
+    uint8_t *rom = load_file(rom_file, &rom_size);
+    rom_init(rom, rom_size);
+    memory_init();
+    if (rom_hash() != header.rom_hash)
+        fprintf(stderr, "Warning: trace was recorded with another ROM\n");
+
+    TRACE_CHUNK chunk;
+    uint8_t *buf = NULL;
+    while (fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        if (chunk.thread >= TRACE_MAX_THREADS)
+            fatal("Corrupted trace chunk\n");
+        buf = realloc(buf, chunk.size);
+        if (!buf || (fread(buf, chunk.size, 1, fp) != 1))
+            fatal("Truncated trace chunk\n");
+        decode_chunk(chunk.thread, buf, buf + chunk.size);
+    }
+    free(buf);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,454 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "disasm.h"
+#include "translate.h"
+#include "liveness.h"
+#include "constptr.h"
+#include "idiom.h"
+
+// Translate Saturn instructions into uops. Decoding follows the same opcode
+// layout as disasm(), which is also used to fetch the opcode and get the
+// instruction length.
+
+// Uop names, as used in profiles and by tools/gen_fuse.py
+const char *uop_names[UOP_TYPE_COUNT] = {
+    "ADD", "SUB", "RSUB", "INC", "DEC", "ADDCON", "SUBCON",
+    "NEG", "NOT", "AND", "OR", "ZERO", "COPY", "EXCH",
+    "SL", "SR", "SRB", "SLC", "SRC",
+    "TEQ", "TNE", "TZ", "TNZ", "TGT", "TLT", "TGE", "TLE",
+    "RSTO", "RLOD", "REXC",
+    "LOAD", "STORE",
+    "DADD", "DSUB", "DSET", "DCOPY", "DEXCH",
+    "PSET", "PINC", "PDEC", "TPEQ", "TPNE", "PTOC", "CTOP",
+    "CPEX", "CPP1",
+    "LHEX",
+    "CLRST", "CST", "STC", "CSTEX", "ST0", "ST1", "TST0",
+    "TST1", "CLRHS", "THS0", "SETHEX", "SETDEC",
+    "BIT0", "BIT1", "TBIT0", "TBIT1",
+    "GOTO", "GOSUB", "GOC", "GONC", "RTN", "RTNSXM", "RTNSC",
+    "RTNCC", "RTNC", "RTNNC", "RTI", "JUMPI", "PCREG",
+    "REGPC", "PCEX", "PUSHC", "POPC",
+    "OUTCS", "OUTC", "IN", "UNCNFG", "CONFIG", "CID",
+    "SHUTDN", "INTON", "INTOFF", "RSI", "RESET", "SREQ",
+    "BUSC", "ILLEGAL",
+    "LOOP"
+};
+
+// Register pairs used by the arithmetic, logic and test groups, indexed by the
+// low 2 bits of the operation nibble. Pair 0 is used by operations 0-3 and
+// pair 1 by operations 8-B.
+static const uint8_t pair0[4][2] = {
+    {R_A, R_B}, {R_B, R_C}, {R_C, R_A}, {R_D, R_C}
+};
+static const uint8_t pair1[4][2] = {
+    {R_B, R_A}, {R_C, R_B}, {R_A, R_C}, {R_C, R_D}
+};
+
+static uint64_t get_imm(const DISASM *instr, int offset, int length) {
+    uint64_t imm = 0;
+    for (int i = 0; i < length; i++)
+        imm |= (uint64_t)instr->opcode[offset + i] << (i * 4);
+    return imm;
+}
+
+static int get_fs(uint8_t value) {
+    return (value > 7) ? F_A : value;
+}
+
+static void set_op(UOP *uop, int op, int field, int dst, int src) {
+    uop->op = op;
+    uop->field = field;
+    uop->dst = dst;
+    uop->src = src;
+}
+
+// GOYES / RTNYES part of a test instruction, in the last 2 nibbles
+static void set_goyes(UOP *uop, const DISASM *instr) {
+    int offset = uop->length - 2;
+    int8_t rel = (int8_t)get_imm(instr, offset, 2);
+    if (rel == 0)
+        uop->flags |= UF_RTNYES;
+    else
+        uop->target = (uop->pc + offset + rel) & ADDR_MASK;
+}
+
+static void decode_arith(UOP *uop, int opn, int field) {
+    int r = opn & 0x3;
+    switch (opn >> 2) {
+    case 0: set_op(uop, UOP_ADD, field, pair0[r][0], pair0[r][1]); break;
+    case 1: set_op(uop, UOP_ADD, field, r, r); break;
+    case 2: set_op(uop, UOP_ADD, field, pair1[r][0], pair1[r][1]); break;
+    case 3: set_op(uop, UOP_DEC, field, r, r); break;
+    }
+}
+
+static void decode_copy(UOP *uop, int opn, int field) {
+    int r = opn & 0x3;
+    switch (opn >> 2) {
+    case 0: set_op(uop, UOP_ZERO, field, r, r); break;
+    case 1: set_op(uop, UOP_COPY, field, pair0[r][0], pair0[r][1]); break;
+    case 2: set_op(uop, UOP_COPY, field, pair1[r][0], pair1[r][1]); break;
+    case 3: set_op(uop, UOP_EXCH, field, pair0[r][0], pair0[r][1]); break;
+    }
+}
+
+static void decode_sub(UOP *uop, int opn, int field) {
+    int r = opn & 0x3;
+    switch (opn >> 2) {
+    case 0: set_op(uop, UOP_SUB, field, pair0[r][0], pair0[r][1]); break;
+    case 1: set_op(uop, UOP_INC, field, r, r); break;
+    case 2: set_op(uop, UOP_SUB, field, pair1[r][0], pair1[r][1]); break;
+    case 3: set_op(uop, UOP_RSUB, field, pair0[r][0], pair0[r][1]); break;
+    }
+}
+
+static void decode_shift(UOP *uop, int opn, int field) {
+    static const uint8_t ops[4] = {UOP_SL, UOP_SR, UOP_NEG, UOP_NOT};
+    set_op(uop, ops[opn >> 2], field, opn & 0x3, opn & 0x3);
+}
+
+static void decode_test(UOP *uop, const DISASM *instr, bool eq, int field) {
+    static const uint8_t eq_ops[4] = {UOP_TEQ, UOP_TNE, UOP_TZ, UOP_TNZ};
+    static const uint8_t ord_ops[4] = {UOP_TGT, UOP_TLT, UOP_TGE, UOP_TLE};
+    int opn = instr->opcode[2];
+    int r = opn & 0x3;
+    if (eq && (opn & 0x8))
+        set_op(uop, eq_ops[opn >> 2], field, r, r);
+    else
+        set_op(uop, eq ? eq_ops[opn >> 2] : ord_ops[opn >> 2], field,
+                pair0[r][0], pair0[r][1]);
+    set_goyes(uop, instr);
+}
+
+// Data transfers between A/C and memory, opcode 14x / 15xy
+static void decode_dat(UOP *uop, const DISASM *instr) {
+    int opn = instr->opcode[2];
+    int field;
+    if (instr->opcode[1] == 0x4)
+        field = (opn & 0x8) ? F_B : F_A;
+    else
+        field = (opn & 0x8) ? F_N(instr->opcode[3] + 1) :
+                get_fs(instr->opcode[3]);
+    set_op(uop, (opn & 0x2) ? UOP_LOAD : UOP_STORE, field, 0, 0);
+    if (opn & 0x2) {
+        uop->dst = (opn & 0x4) ? R_C : R_A;
+        uop->src = opn & 0x1;
+    }
+    else {
+        uop->dst = opn & 0x1;
+        uop->src = (opn & 0x4) ? R_C : R_A;
+    }
+}
+
+// Scratch register transfers, opcode 10x / 11x / 12x and 81Afyx
+static void decode_scratch(UOP *uop, int kind, int opn, int field) {
+    static const uint8_t ops[3] = {UOP_RSTO, UOP_RLOD, UOP_REXC};
+    int r = (opn & 0x8) ? R_C : R_A;
+    if ((opn & 0x7) > 4) {
+        set_op(uop, UOP_ILLEGAL, 0, 0, 0);
+        return;
+    }
+    set_op(uop, ops[kind], field, r, r);
+    uop->imm = opn & 0x7;
+}
+
+static void decode_group0(UOP *uop, const DISASM *instr) {
+    static const uint8_t ops[16] = {
+        UOP_RTNSXM, UOP_RTN, UOP_RTNSC, UOP_RTNCC, UOP_SETHEX, UOP_SETDEC,
+        UOP_PUSHC, UOP_POPC, UOP_CLRST, UOP_CST, UOP_STC, UOP_CSTEX,
+        UOP_PINC, UOP_PDEC, UOP_ILLEGAL, UOP_RTI
+    };
+    int opn = instr->opcode[3];
+    if (instr->opcode[1] != 0xE) {
+        set_op(uop, ops[instr->opcode[1]], 0, 0, 0);
+        return;
+    }
+    // Logic operations 0Efx
+    int field = get_fs(instr->opcode[2]);
+    int r = opn & 0x3;
+    int op = (opn & 0x8) ? UOP_OR : UOP_AND;
+    if (opn & 0x4)
+        set_op(uop, op, field, pair1[r][0], pair1[r][1]);
+    else
+        set_op(uop, op, field, pair0[r][0], pair0[r][1]);
+}
+
+static void decode_group1(UOP *uop, const DISASM *instr) {
+    int opn = instr->opcode[2];
+    switch (instr->opcode[1]) {
+    case 0x0: decode_scratch(uop, 0, opn, F_W); break;
+    case 0x1: decode_scratch(uop, 1, opn, F_W); break;
+    case 0x2: decode_scratch(uop, 2, opn, F_W); break;
+    case 0x3:
+        set_op(uop, (opn & 0x2) ? UOP_DEXCH : UOP_DCOPY, 0, opn & 0x1,
+                (opn & 0x4) ? R_C : R_A);
+        uop->imm = (opn & 0x8) ? 4 : 5;
+        break;
+    case 0x4:
+    case 0x5: decode_dat(uop, instr); break;
+    case 0x6: set_op(uop, UOP_DADD, 0, 0, 0); uop->imm = opn + 1; break;
+    case 0x7: set_op(uop, UOP_DADD, 0, 1, 0); uop->imm = opn + 1; break;
+    case 0x8: set_op(uop, UOP_DSUB, 0, 0, 0); uop->imm = opn + 1; break;
+    case 0xC: set_op(uop, UOP_DSUB, 0, 1, 0); uop->imm = opn + 1; break;
+    case 0x9: case 0xA: case 0xB:
+    case 0xD: case 0xE: case 0xF:
+        // Number of nibbles is kept in src
+        set_op(uop, UOP_DSET, 0, (instr->opcode[1] >= 0xD) ? 1 : 0,
+                uop->length - 2);
+        uop->imm = get_imm(instr, 2, uop->length - 2);
+        break;
+    }
+}
+
+static void decode_group80(UOP *uop, const DISASM *instr) {
+    static const uint8_t ops[16] = {
+        UOP_OUTCS, UOP_OUTC, UOP_IN, UOP_IN, UOP_UNCNFG, UOP_CONFIG, UOP_CID,
+        UOP_SHUTDN, UOP_ILLEGAL, UOP_CPP1, UOP_RESET, UOP_BUSC, UOP_PTOC,
+        UOP_CTOP, UOP_SREQ, UOP_CPEX
+    };
+    int opn = instr->opcode[2];
+    set_op(uop, ops[opn], 0, (opn == 0x2) ? R_A : R_C, 0);
+    if ((opn == 0xC) || (opn == 0xD) || (opn == 0xF))
+        uop->imm = instr->opcode[3];
+    if (opn != 0x8)
+        return;
+    opn = instr->opcode[3];
+    switch (opn) {
+    case 0x0: set_op(uop, UOP_INTON, 0, 0, 0); break;
+    case 0x1: set_op(uop, UOP_RSI, 0, 0, 0); break;
+    case 0x2:
+        set_op(uop, UOP_LHEX, 0, R_A, instr->opcode[4] + 1);
+        uop->imm = get_imm(instr, 5, uop->src);
+        break;
+    case 0x3: case 0xD: set_op(uop, UOP_BUSC, 0, 0, 0); break;
+    case 0x4: case 0x5: case 0x8: case 0x9:
+        set_op(uop, (opn & 0x1) ? UOP_BIT1 : UOP_BIT0, 0,
+                (opn & 0x8) ? R_C : R_A, 0);
+        uop->imm = instr->opcode[4];
+        break;
+    case 0x6: case 0x7: case 0xA: case 0xB:
+        set_op(uop, (opn & 0x1) ? UOP_TBIT1 : UOP_TBIT0, 0,
+                (opn & 0x8) ? R_C : R_A, 0);
+        uop->imm = instr->opcode[4];
+        set_goyes(uop, instr);
+        break;
+    case 0xC: set_op(uop, UOP_JUMPI, 0, R_A, 0); break;
+    case 0xF: set_op(uop, UOP_INTOFF, 0, 0, 0); break;
+    default: set_op(uop, UOP_ILLEGAL, 0, 0, 0); break;
+    }
+}
+
+static void decode_group81(UOP *uop, const DISASM *instr) {
+    int opn = instr->opcode[2];
+    int field = get_fs(instr->opcode[3]);
+    if (opn < 0x8) {
+        set_op(uop, (opn & 0x4) ? UOP_SRC : UOP_SLC, F_W, opn & 0x3,
+                opn & 0x3);
+    }
+    else if (opn >= 0xC) {
+        set_op(uop, UOP_SRB, F_W, opn & 0x3, opn & 0x3);
+    }
+    else if (opn == 0x8) {
+        set_op(uop, (instr->opcode[4] & 0x8) ? UOP_SUBCON : UOP_ADDCON,
+                field, instr->opcode[4] & 0x3, instr->opcode[4] & 0x3);
+        uop->imm = instr->opcode[5] + 1;
+    }
+    else if (opn == 0x9) {
+        set_op(uop, UOP_SRB, field, instr->opcode[4] & 0x3,
+                instr->opcode[4] & 0x3);
+    }
+    else if (opn == 0xA) {
+        decode_scratch(uop, instr->opcode[4], instr->opcode[5], field);
+    }
+    else {
+        switch (instr->opcode[3]) {
+        case 0x2: set_op(uop, UOP_PCREG, 0, R_A, 0); break;
+        case 0x3: set_op(uop, UOP_PCREG, 0, R_C, 0); break;
+        case 0x4: set_op(uop, UOP_REGPC, 0, R_A, 0); break;
+        case 0x5: set_op(uop, UOP_REGPC, 0, R_C, 0); break;
+        case 0x6: set_op(uop, UOP_PCEX, 0, R_A, 0); break;
+        case 0x7: set_op(uop, UOP_PCEX, 0, R_C, 0); break;
+        default: set_op(uop, UOP_ILLEGAL, 0, 0, 0); break;
+        }
+    }
+}
+
+static void decode_group8(UOP *uop, const DISASM *instr) {
+    int opn = instr->opcode[2];
+    switch (instr->opcode[1]) {
+    case 0x0: decode_group80(uop, instr); break;
+    case 0x1: decode_group81(uop, instr); break;
+    case 0x2: set_op(uop, UOP_CLRHS, 0, 0, 0); uop->imm = opn; break;
+    case 0x3:
+        set_op(uop, UOP_THS0, 0, 0, 0);
+        uop->imm = opn;
+        set_goyes(uop, instr);
+        break;
+    case 0x4: set_op(uop, UOP_ST0, 0, 0, 0); uop->imm = opn; break;
+    case 0x5: set_op(uop, UOP_ST1, 0, 0, 0); uop->imm = opn; break;
+    case 0x6:
+    case 0x7:
+    case 0x8:
+    case 0x9: {
+        static const uint8_t ops[4] = {UOP_TST0, UOP_TST1, UOP_TPNE, UOP_TPEQ};
+        set_op(uop, ops[instr->opcode[1] - 0x6], 0, 0, 0);
+        uop->imm = opn;
+        set_goyes(uop, instr);
+        break;
+    }
+    case 0xA: decode_test(uop, instr, true, F_A); break;
+    case 0xB: decode_test(uop, instr, false, F_A); break;
+    case 0xC:
+        set_op(uop, UOP_GOTO, 0, 0, 0);
+        uop->target = uop->pc + 2 + (int16_t)get_imm(instr, 2, 4);
+        break;
+    case 0xD:
+        set_op(uop, UOP_GOTO, 0, 0, 0);
+        uop->target = get_imm(instr, 2, 5);
+        break;
+    case 0xE:
+        set_op(uop, UOP_GOSUB, 0, 0, 0);
+        uop->target = uop->pc + 6 + (int16_t)get_imm(instr, 2, 4);
+        break;
+    case 0xF:
+        set_op(uop, UOP_GOSUB, 0, 0, 0);
+        uop->target = get_imm(instr, 2, 5);
+        break;
+    }
+    uop->target &= ADDR_MASK;
+}
+
+// Sign extend the 12 bit GOTO / GOSUB offset
+static int get_s12(uint64_t value) {
+    int16_t val = value << 4;
+    return val >> 4;
+}
+
+void translate_insn(UOP *uop, uint32_t pc) {
+    DISASM instr;
+    disasm(&instr, pc);
+    memset(uop, 0, sizeof(UOP));
+    uop->pc = pc;
+    uop->length = instr.length;
+    if (strcmp(instr.disasm, "Illegal") == 0) {
+        set_op(uop, UOP_ILLEGAL, 0, 0, 0);
+        return;
+    }
+
+    uint8_t *op = instr.opcode;
+    switch (op[0]) {
+    case 0x0: decode_group0(uop, &instr); break;
+    case 0x1: decode_group1(uop, &instr); break;
+    case 0x2: set_op(uop, UOP_PSET, 0, 0, 0); uop->imm = op[1]; break;
+    case 0x3:
+        set_op(uop, UOP_LHEX, 0, R_C, op[1] + 1);
+        uop->imm = get_imm(&instr, 2, uop->src);
+        break;
+    case 0x4:
+    case 0x5:
+        if ((op[1] == 0) && (op[2] == 0)) {
+            set_op(uop, (op[0] == 0x4) ? UOP_RTNC : UOP_RTNNC, 0, 0, 0);
+        }
+        else {
+            set_op(uop, (op[0] == 0x4) ? UOP_GOC : UOP_GONC, 0, 0, 0);
+            uop->target = (pc + 1 + (int8_t)get_imm(&instr, 1, 2)) & ADDR_MASK;
+        }
+        break;
+    case 0x6:
+        set_op(uop, UOP_GOTO, 0, 0, 0);
+        uop->target = (pc + 1 + get_s12(get_imm(&instr, 1, 3))) & ADDR_MASK;
+        break;
+    case 0x7:
+        set_op(uop, UOP_GOSUB, 0, 0, 0);
+        uop->target = (pc + 4 + get_s12(get_imm(&instr, 1, 3))) & ADDR_MASK;
+        break;
+    case 0x8: decode_group8(uop, &instr); break;
+    case 0x9:
+        decode_test(uop, &instr, !(op[1] & 0x8), op[1] & 0x7);
+        break;
+    case 0xA:
+        if (op[1] & 0x8)
+            decode_copy(uop, op[2], op[1] & 0x7);
+        else
+            decode_arith(uop, op[2], op[1] & 0x7);
+        break;
+    case 0xB:
+        if (op[1] & 0x8)
+            decode_shift(uop, op[2], op[1] & 0x7);
+        else
+            decode_sub(uop, op[2], op[1] & 0x7);
+        break;
+    case 0xC: decode_arith(uop, op[1], F_A); break;
+    case 0xD: decode_copy(uop, op[1], F_A); break;
+    case 0xE: decode_sub(uop, op[1], F_A); break;
+    case 0xF: decode_shift(uop, op[1], F_A); break;
+    }
+}
+
+bool translate_ends_block(const UOP *uop) {
+    switch (uop->op) {
+    case UOP_TEQ: case UOP_TNE: case UOP_TZ: case UOP_TNZ:
+    case UOP_TGT: case UOP_TLT: case UOP_TGE: case UOP_TLE:
+    case UOP_TPEQ: case UOP_TPNE: case UOP_TST0: case UOP_TST1:
+    case UOP_THS0: case UOP_TBIT0: case UOP_TBIT1:
+    case UOP_GOTO: case UOP_GOSUB: case UOP_GOC: case UOP_GONC:
+    case UOP_RTN: case UOP_RTNSXM: case UOP_RTNSC: case UOP_RTNCC:
+    case UOP_RTNC: case UOP_RTNNC: case UOP_RTI: case UOP_JUMPI:
+    case UOP_PCREG: case UOP_PCEX:
+    case UOP_UNCNFG: case UOP_CONFIG: case UOP_SHUTDN: case UOP_INTON:
+    case UOP_RSI: case UOP_RESET: case UOP_ILLEGAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Decode instructions until the end of the basic block, without running any
+// optimization pass
+void translate_decode(BLOCK *block, uint32_t pc) {
+    block->pc = pc;
+    block->count = 0;
+    block->carry_elided = 0;
+    block->dead_elided = 0;
+    while (block->count < BLOCK_MAX_UOPS) {
+        UOP *uop = &block->uop[block->count++];
+        translate_insn(uop, pc);
+        pc = (pc + uop->length) & ADDR_MASK;
+        if (translate_ends_block(uop))
+            break;
+    }
+    block->end = pc;
+}
+
+void translate_block(BLOCK *block, uint32_t pc) {
+    translate_decode(block, pc);
+    liveness_block(block);
+    constptr_block(block);
+    idiom_block(block);
+}
@@ -0,0 +1,123 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+#define BLOCK_MAX_UOPS      (32) // Maximum number of instructions per block
+// Bump whenever translated blocks change: uop layout, decoding or analysis
+#define TRANSLATE_VERSION   (3)
+
+// Working registers, in the order used by the register field of uops
+#define R_A     0
+#define R_B     1
+#define R_C     2
+#define R_D     3
+
+// Counted nibble transfers (DATx=A n) use fields F_N(1) to F_N(16), which
+// cover nibble 0 to n-1
+#define F_N(n)  (F_A + (n))
+#define F_COUNT (F_N(16) + 1)
+
+typedef enum {
+    // Working register arithmetic, dst = dst op src over field
+    UOP_ADD, UOP_SUB, UOP_RSUB, UOP_INC, UOP_DEC, UOP_ADDCON, UOP_SUBCON,
+    UOP_NEG, UOP_NOT, UOP_AND, UOP_OR, UOP_ZERO, UOP_COPY, UOP_EXCH,
+    UOP_SL, UOP_SR, UOP_SRB, UOP_SLC, UOP_SRC,
+    // Register compare, sets carry and branches to target if true
+    UOP_TEQ, UOP_TNE, UOP_TZ, UOP_TNZ, UOP_TGT, UOP_TLT, UOP_TGE, UOP_TLE,
+    // Scratch registers, imm is the scratch register number
+    UOP_RSTO, UOP_RLOD, UOP_REXC,
+    // Memory, src is the pointer register (0 = D0, 1 = D1)
+    UOP_LOAD, UOP_STORE,
+    // Pointer registers, dst is the pointer register
+    UOP_DADD, UOP_DSUB, UOP_DSET, UOP_DCOPY, UOP_DEXCH,
+    // P register
+    UOP_PSET, UOP_PINC, UOP_PDEC, UOP_TPEQ, UOP_TPNE, UOP_PTOC, UOP_CTOP,
+    UOP_CPEX, UOP_CPP1,
+    // Load immediate into dst starting at nibble P, imm holds n nibbles
+    UOP_LHEX,
+    // Status bits
+    UOP_CLRST, UOP_CST, UOP_STC, UOP_CSTEX, UOP_ST0, UOP_ST1, UOP_TST0,
+    UOP_TST1, UOP_CLRHS, UOP_THS0, UOP_SETHEX, UOP_SETDEC,
+    UOP_BIT0, UOP_BIT1, UOP_TBIT0, UOP_TBIT1,
+    // Control flow
+    UOP_GOTO, UOP_GOSUB, UOP_GOC, UOP_GONC, UOP_RTN, UOP_RTNSXM, UOP_RTNSC,
+    UOP_RTNCC, UOP_RTNC, UOP_RTNNC, UOP_RTI, UOP_JUMPI, UOP_PCREG,
+    UOP_REGPC, UOP_PCEX, UOP_PUSHC, UOP_POPC,
+    // System and I/O
+    UOP_OUTCS, UOP_OUTC, UOP_IN, UOP_UNCNFG, UOP_CONFIG, UOP_CID,
+    UOP_SHUTDN, UOP_INTON, UOP_INTOFF, UOP_RSI, UOP_RESET, UOP_SREQ,
+    UOP_BUSC, UOP_ILLEGAL,
+    // Bulk run of a copy, fill or scan loop, the loop body follows and src
+    // is its number of uops, see idiom.c
+    UOP_LOOP,
+    UOP_TYPE_COUNT
+} UOP_TYPE;
+
+// UOP flags
+#define UF_RTNYES       (1u << 0) // Conditional is RTNYES instead of GOYES
+#define UF_NO_CARRY     (1u << 1) // Carry result is never read
+#define UF_DEAD         (1u << 2) // Whole uop result is never read
+#define UF_CONST_PTR    (1u << 3) // Memory access at the constant address in imm
+
+typedef struct {
+    uint8_t op;         // UOP_*
+    uint8_t field;      // F_* field selector
+    uint8_t dst;        // Destination register
+    uint8_t src;        // Source register
+    uint8_t length;     // Instruction length, in nibbles
+    uint8_t flags;      // UF_*
+    uint32_t pc;        // Address of the instruction
+    uint32_t target;    // Branch target or return address, or module
+                        // offset of a UF_CONST_PTR access
+    uint64_t imm;       // Immediate value
+} UOP;
+
+// Uop handler, returns non-zero when it leaves the block, with PC updated
+typedef int (*UOP_FUNC)(const UOP *uop);
+
+// One dispatch in a translated block, a fused handler runs several
+// consecutive uops starting from uop
+typedef struct {
+    UOP_FUNC func;
+    const UOP *uop;
+} EXEC_SLOT;
+
+typedef struct {
+    uint32_t pc;        // Entry address
+    uint32_t end;       // Address following the last instruction
+    int count;          // Number of uops
+    int carry_elided;   // Carry computations removed by liveness analysis
+    int dead_elided;    // Uops removed completely by liveness analysis
+    int cycles;         // Estimated cycles to run the whole block
+    int insns;          // Guest instructions in the block
+    uint64_t exec_count; // Number of times the block was run
+    UOP uop[BLOCK_MAX_UOPS];
+    EXEC_SLOT slot[BLOCK_MAX_UOPS + 1]; // NULL terminated
+} BLOCK;
+
+extern const char *uop_names[UOP_TYPE_COUNT];
+
+void translate_insn(UOP *uop, uint32_t pc);
+bool translate_ends_block(const UOP *uop);
+void translate_decode(BLOCK *block, uint32_t pc);
+void translate_block(BLOCK *block, uint32_t pc);
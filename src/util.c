@@ -25,7 +25,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "config.h"
+#include "util.h"
 
 void fatal(const char *msg, ...) {
     va_list params;
@@ -37,4 +40,54 @@ void fatal(const char *msg, ...) {
     exit(1);
 
     va_end(params);
-}
\ No newline at end of file
+}
+
+// Read a whole file into a malloc'd buffer and give its size in bytes,
+// exits if it can not be read
+uint8_t *load_file(const char *fn, size_t *size) {
+    FILE *fp = fopen(fn, "rb");
+    if (!fp)
+        fatal("Unable to open file %s\n", fn);
+    long fsize = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        fsize = ftell(fp);
+    if ((fsize <= 0) || (fseek(fp, 0, SEEK_SET) != 0))
+        fatal("Unable to read file %s, or it is empty\n", fn);
+    uint8_t *mem = malloc(fsize);
+    if (!mem)
+        fatal("Unable to allocate %ld bytes for file %s\n", fsize, fn);
+    if (fread(mem, fsize, 1, fp) != 1)
+        fatal("Unable to read file %s\n", fn);
+    fclose(fp);
+    *size = fsize;
+    return mem;
+}
+
+// Files other runs may read are written to a temporary file next to them
+// and renamed over them, so readers never see a partial file. Creates the
+// temporary file for fn, its name goes in tmp_fn of TEMP_NAME_MAX bytes.
+FILE *temp_create(const char *fn, char *tmp_fn) {
+    if (snprintf(tmp_fn, TEMP_NAME_MAX, "%s.XXXXXX", fn) >= TEMP_NAME_MAX)
+        return NULL;
+    int fd = mkstemp(tmp_fn);
+    if (fd < 0)
+        return NULL;
+    fchmod(fd, 0644);
+    FILE *fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        unlink(tmp_fn);
+    }
+    return fp;
+}
+
+// Close a file from temp_create() and replace fn with it if ok is set,
+// otherwise remove it. Returns true if fn was replaced.
+bool temp_replace(FILE *fp, const char *tmp_fn, const char *fn, bool ok) {
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_fn, fn) == 0;
+    if (!ok)
+        unlink(tmp_fn);
+    return ok;
+}
@@ -23,6 +23,8 @@
 #pragma once
 #include <time.h>
 
+#define TEMP_NAME_MAX   (4096)
+
 #define PROFILE_FUNC(x) { \
     clock_t t = clock();\
     x;\
@@ -31,3 +33,6 @@
 }
 
 void fatal(const char *msg, ...);
+uint8_t *load_file(const char *fn, size_t *size);
+FILE *temp_create(const char *fn, char *tmp_fn);
+bool temp_replace(FILE *fp, const char *tmp_fn, const char *fn, bool ok);
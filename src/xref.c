@@ -0,0 +1,244 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "util.h"
+#include "rom.h"
+#include "memory.h"
+#include "translate.h"
+#include "xref.h"
+
+// Cross-reference index of the ROM. A linear sweep decodes every instruction
+// once and records the addresses it branches to or loads as a literal. The
+// references are kept twice in compressed sparse row form: sorted by target
+// and sorted by source, each with an offset array over the whole address
+// space. References to or from any address range are then a contiguous
+// slice found with two lookups.
+//
+// File layout: XREF_HEADER, then offsets by target (ADDR_MASK + 2 entries),
+// references by target, offsets by source, references by source.
+
+#define XREF_MAGIC      "SXR1"
+#define OFFSET_COUNT    (ADDR_MASK + 2)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;   // TRANSLATE_VERSION, references come from the decoder
+    uint64_t rom_hash;
+    uint32_t count;     // Number of references
+    uint32_t reserved;
+} XREF_HEADER;
+
+static void *map;
+static size_t map_size;
+static bool mapped;
+static const uint32_t *to_offset;
+static const XREF *to_refs;
+static const uint32_t *from_offset;
+static const XREF *from_refs;
+
+static size_t file_size(uint32_t count) {
+    return sizeof(XREF_HEADER) + 2 * (OFFSET_COUNT * sizeof(uint32_t) +
+            (size_t)count * sizeof(XREF));
+}
+
+static void set_pointers(uint32_t count) {
+    uint8_t *p = (uint8_t *)map + sizeof(XREF_HEADER);
+    to_offset = (const uint32_t *)p;
+    p += OFFSET_COUNT * sizeof(uint32_t);
+    to_refs = (const XREF *)p;
+    p += count * sizeof(XREF);
+    from_offset = (const uint32_t *)p;
+    p += OFFSET_COUNT * sizeof(uint32_t);
+    from_refs = (const XREF *)p;
+}
+
+// Reference made by a decoded instruction, returns false if there is none
+static bool get_ref(const UOP *u, XREF *ref) {
+    ref->from = u->pc;
+    ref->to = u->target;
+    switch (u->op) {
+    case UOP_GOSUB:
+        ref->kind = XREF_CALL;
+        return true;
+    case UOP_GOTO:
+    case UOP_GOC:
+    case UOP_GONC:
+        ref->kind = XREF_JUMP;
+        return true;
+    case UOP_TEQ: case UOP_TNE: case UOP_TZ: case UOP_TNZ:
+    case UOP_TGT: case UOP_TLT: case UOP_TGE: case UOP_TLE:
+    case UOP_TPEQ: case UOP_TPNE: case UOP_TST0: case UOP_TST1:
+    case UOP_THS0: case UOP_TBIT0: case UOP_TBIT1:
+        ref->kind = XREF_JUMP;
+        return !(u->flags & UF_RTNYES);
+    case UOP_DSET:
+    case UOP_LHEX:
+        ref->kind = XREF_DATA;
+        ref->to = u->imm;
+        return u->src == 5;
+    default:
+        return false;
+    }
+}
+
+// Build the index of the ROM currently on the bus into a new buffer
+static void build() {
+    size_t alloc = 65536;
+    uint32_t count = 0;
+    XREF *refs = malloc(alloc * sizeof(XREF));
+    if (!refs)
+        fatal("Unable to allocate cross-reference index\n");
+
+    // Sources are visited in order, so refs is already sorted by source
+    for (uint32_t pc = 0; pc <= ADDR_MASK;) {
+        UOP u;
+        translate_insn(&u, pc);
+        if (get_ref(&u, &refs[count])) {
+            if (++count == alloc) {
+                alloc *= 2;
+                refs = realloc(refs, alloc * sizeof(XREF));
+                if (!refs)
+                    fatal("Unable to allocate cross-reference index\n");
+            }
+        }
+        pc += u.length ? u.length : 1;
+    }
+
+    map_size = file_size(count);
+    map = calloc(1, map_size);
+    if (!map)
+        fatal("Unable to allocate cross-reference index\n");
+    XREF_HEADER *header = map;
+    memcpy(header->magic, XREF_MAGIC, 4);
+    header->version = TRANSLATE_VERSION;
+    header->rom_hash = rom_hash();
+    header->count = count;
+    set_pointers(count);
+
+    uint32_t *offset = (uint32_t *)from_offset;
+    memcpy((XREF *)from_refs, refs, count * sizeof(XREF));
+    for (uint32_t i = 0; i < count; i++)
+        offset[refs[i].from + 1]++;
+    for (uint32_t i = 1; i < OFFSET_COUNT; i++)
+        offset[i] += offset[i - 1];
+
+    // Counting sort by target, stable so each slice stays sorted by source
+    offset = (uint32_t *)to_offset;
+    for (uint32_t i = 0; i < count; i++)
+        offset[refs[i].to + 1]++;
+    for (uint32_t i = 1; i < OFFSET_COUNT; i++)
+        offset[i] += offset[i - 1];
+    uint32_t *next = malloc(OFFSET_COUNT * sizeof(uint32_t));
+    if (!next)
+        fatal("Unable to allocate cross-reference index\n");
+    memcpy(next, offset, OFFSET_COUNT * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++)
+        ((XREF *)to_refs)[next[refs[i].to]++] = refs[i];
+
+    free(next);
+    free(refs);
+}
+
+static bool load(const char *fn) {
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((fstat(fd, &st) < 0) ||
+            ((size_t)st.st_size < sizeof(XREF_HEADER))) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    const XREF_HEADER *header = p;
+    if (memcmp(header->magic, XREF_MAGIC, 4) ||
+            (header->version != TRANSLATE_VERSION) ||
+            (header->rom_hash != rom_hash()) ||
+            (file_size(header->count) != (size_t)st.st_size)) {
+        munmap(p, st.st_size);
+        return false;
+    }
+    map = p;
+    map_size = st.st_size;
+    mapped = true;
+    set_pointers(header->count);
+    return true;
+}
+
+// Replaces fn as a whole, so concurrent runs never load a torn index
+static bool save(const char *fn) {
+    char tmp_fn[TEMP_NAME_MAX];
+    FILE *fp = temp_create(fn, tmp_fn);
+    if (!fp)
+        return false;
+    bool ok = fwrite(map, map_size, 1, fp) == 1;
+    return temp_replace(fp, tmp_fn, fn, ok);
+}
+
+// Load the index of the current ROM from fn, or build it and save it there.
+// Returns false if the index was built but could not be saved.
+bool xref_open(const char *fn) {
+    xref_close();
+    if (load(fn))
+        return true;
+    build();
+    return save(fn);
+}
+
+void xref_close() {
+    if (map && mapped)
+        munmap(map, map_size);
+    else
+        free(map);
+    map = NULL;
+    mapped = false;
+}
+
+// References to addresses start to end inclusive, sorted by target
+int xref_to(uint32_t start, uint32_t end, const XREF **refs) {
+    *refs = &to_refs[to_offset[start]];
+    return to_offset[end + 1] - to_offset[start];
+}
+
+// References made by instructions at addresses start to end inclusive
+int xref_from(uint32_t start, uint32_t end, const XREF **refs) {
+    *refs = &from_refs[from_offset[start]];
+    return from_offset[end + 1] - from_offset[start];
+}
+
+const char *xref_kind_name(int kind) {
+    static const char *names[] = { "call", "jump", "data" };
+    return names[kind];
+}
@@ -0,0 +1,40 @@
+//
+// Satrec
+// Copyright 2022 Wenting Zhang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+
+// Kinds of references
+#define XREF_CALL   0 // GOSUB, GOSUBL, GOSBVL
+#define XREF_JUMP   1 // GOTO, GOLONG, GOVLNG, GOC, GONC, GOYES
+#define XREF_DATA   2 // D0=(5), D1=(5), LA(5) and LC(5) address literals
+
+typedef struct {
+    uint32_t from;      // Address of the referencing instruction
+    uint32_t to;        // Referenced address
+    uint32_t kind;      // XREF_*
+} XREF;
+
+bool xref_open(const char *fn);
+void xref_close();
+int xref_to(uint32_t start, uint32_t end, const XREF **refs);
+int xref_from(uint32_t start, uint32_t end, const XREF **refs);
+const char *xref_kind_name(int kind);